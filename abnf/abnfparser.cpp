@@ -148,12 +148,18 @@ void AbnfParser::step( uint n )
 
 bool AbnfParser::present( const EString & s )
 {
-    if ( s.isEmpty() )
-        return true;
-
-    EString l = str.mid( d->at, s.length() ).lower();
-    if ( l != s.lower() )
-        return false;
+    uint i = 0;
+    while ( i < s.length() ) {
+        char a = str[d->at+i];
+        char b = s[i];
+        if ( a >= 'A' && a <= 'Z' )
+            a = a + 32;
+        if ( b >= 'A' && b <= 'Z' )
+            b = b + 32;
+        if ( a != b )
+            return false;
+        i++;
+    }
 
     step( s.length() );
     return true;
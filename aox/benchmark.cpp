@@ -0,0 +1,183 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "benchmark.h"
+
+#include "file.h"
+#include "buffer.h"
+#include "message.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <sys/time.h> // gettimeofday()
+
+
+static AoxFactory<BenchmarkParser>
+f( "benchmark", "parser", "Measure how fast messages are parsed.",
+   "    Synopsis: aox benchmark parser file...\n\n"
+   "    Reads mail messages from the named files, one message per\n"
+   "    file (e.g. a maildir's cur/*), and parses them repeatedly for\n"
+   "    a few seconds. Prints how many messages and megabytes were\n"
+   "    parsed per second, and how many messages could not be parsed.\n"
+   );
+
+
+/*! \class BenchmarkParser benchmark.h
+    This class handles the "aox benchmark parser" command.
+
+    The messages are parsed as the injector would, and the time spent
+    collecting garbage between rounds is not counted.
+*/
+
+BenchmarkParser::BenchmarkParser( EStringList * args )
+    : AoxCommand( args ), corpus( new EStringList )
+{
+}
+
+
+/*! Returns the number of microseconds since \a then. */
+
+static int64 since( const struct timeval & then )
+{
+    struct timeval now;
+    (void)::gettimeofday( &now, 0 );
+    return ( now.tv_sec - then.tv_sec ) * (int64)1000000 +
+        now.tv_usec - then.tv_usec;
+}
+
+
+void BenchmarkParser::execute()
+{
+    int64 bytes = 0;
+    EString name = next();
+    while ( !name.isEmpty() ) {
+        File f( name );
+        if ( !f.valid() )
+            error( "Couldn't open file: " + name );
+        corpus->append( f.contents() );
+        bytes += f.contents().length();
+        name = next();
+    }
+    end();
+
+    if ( corpus->isEmpty() )
+        error( "No messages to parse" );
+
+    uint bad = 0;
+    EStringList::Iterator i( corpus );
+    while ( i ) {
+        Message * m = new Message;
+        m->parse( *i );
+        if ( !m->valid() )
+            bad++;
+        ++i;
+    }
+
+    uint rounds = 0;
+    int64 elapsed = 0;
+    while ( elapsed < 3000000 ) {
+        Allocator::free();
+        struct timeval started;
+        (void)::gettimeofday( &started, 0 );
+        EStringList::Iterator i( corpus );
+        while ( i ) {
+            Message * m = new Message;
+            m->parse( *i );
+            ++i;
+        }
+        elapsed += since( started );
+        rounds++;
+    }
+
+    double seconds = elapsed / 1000000.0;
+    printf( "Parsed %d messages (%s) %d times in %.2fs: "
+            "%.0f messages/s, %.1f MB/s.\n",
+            corpus->count(), EString::humanNumber( bytes ).cstr(),
+            rounds, seconds,
+            corpus->count() * rounds / seconds,
+            bytes * rounds / seconds / 1048576 );
+    if ( bad )
+        printf( "%d messages could not be parsed.\n", bad );
+
+    finish();
+}
+
+
+static AoxFactory<BenchmarkLines>
+l( "benchmark", "lines", "Measure how fast protocol input is read.",
+   "    Synopsis: aox benchmark lines file...\n\n"
+   "    Reads client input (e.g. an IMAP or SMTP transcript) from the\n"
+   "    named files, and repeatedly splits it into lines and words the\n"
+   "    way the servers read commands, for a few seconds. Prints how\n"
+   "    many lines and megabytes were read per second.\n"
+   );
+
+
+/*! \class BenchmarkLines benchmark.h
+    This class handles the "aox benchmark lines" command.
+
+    The input is fed through a Buffer in the same size chunks as
+    Buffer::read() uses, and each line is removed and split into
+    words, which is roughly what the IMAP and SMTP servers do before
+    handing a command to its handler.
+*/
+
+BenchmarkLines::BenchmarkLines( EStringList * args )
+    : AoxCommand( args ), corpus( new EStringList )
+{
+}
+
+
+void BenchmarkLines::execute()
+{
+    int64 bytes = 0;
+    EString name = next();
+    while ( !name.isEmpty() ) {
+        File f( name );
+        if ( !f.valid() )
+            error( "Couldn't open file: " + name );
+        corpus->append( f.contents() );
+        bytes += f.contents().length();
+        name = next();
+    }
+    end();
+
+    if ( !bytes )
+        error( "No input to read" );
+
+    uint lines = 0;
+    uint words = 0;
+    uint rounds = 0;
+    int64 elapsed = 0;
+    while ( elapsed < 3000000 ) {
+        Allocator::free();
+        struct timeval started;
+        (void)::gettimeofday( &started, 0 );
+        EStringList::Iterator i( corpus );
+        while ( i ) {
+            Buffer * b = new Buffer;
+            uint o = 0;
+            while ( o < i->length() ) {
+                b->append( i->mid( o, 32768 ) );
+                o += 32768;
+                EString * line;
+                while ( ( line = b->removeLine() ) != 0 ) {
+                    words += EStringList::split( ' ', *line )->count();
+                    lines++;
+                }
+            }
+            ++i;
+        }
+        elapsed += since( started );
+        rounds++;
+    }
+
+    double seconds = elapsed / 1000000.0;
+    printf( "Read %d lines, %d words (%s) %d times in %.2fs: "
+            "%.0f lines/s, %.1f MB/s.\n",
+            lines / rounds, words / rounds,
+            EString::humanNumber( bytes ).cstr(),
+            rounds, seconds, lines / seconds,
+            bytes * rounds / seconds / 1048576 );
+
+    finish();
+}
@@ -0,0 +1,33 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "aoxcommand.h"
+
+
+class BenchmarkParser
+    : public AoxCommand
+{
+public:
+    BenchmarkParser( EStringList * );
+    void execute();
+
+private:
+    EStringList * corpus;
+};
+
+
+class BenchmarkLines
+    : public AoxCommand
+{
+public:
+    BenchmarkLines( EStringList * );
+    void execute();
+
+private:
+    EStringList * corpus;
+};
+
+
+#endif
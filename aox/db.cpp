@@ -2,17 +2,22 @@
 
 #include "db.h"
 
+#include "dict.h"
 #include "query.h"
+#include "timer.h"
 #include "schema.h"
 #include "mailbox.h"
 #include "granter.h"
 #include "postgres.h"
 #include "selector.h"
+#include "blobstore.h"
 #include "recipient.h"
+#include "integerset.h"
 #include "transaction.h"
 #include "configuration.h"
 
 #include <stdio.h>
+#include <time.h> // time()
 
 
 static const char * versions[] = {
@@ -139,199 +144,593 @@ void UpgradeSchema::execute()
 }
 
 
+class VacuumData
+    : public Garbage
+{
+public:
+    VacuumData()
+        : step( Retaining ), t( 0 ), r( 0 ), s( 0 ),
+          find( 0 ), parts( 0 ), orphans( 0 ), bodyparts( 0 ), blobs( 0 ),
+          pause( 0 ), files( 0 ), used( 0 ), directory( 0 ),
+          indexes( 0 ), indexed( true ),
+          last( 0 ), batch( 1024 ), found( 0 ), started( 0 ),
+          removedMessages( 0 ), removedBodyparts( 0 ), removedFiles( 0 )
+    {}
+
+    enum Step { Retaining, Deliveries, Expired, Sweeping, Files, Done };
+    Step step;
+
+    Transaction * t;
+    RetentionSelector * r;
+    Selector * s;
+
+    Query * find;
+    Query * parts;
+    Query * orphans;
+    Query * bodyparts;
+    Query * blobs;
+    Timer * pause;
+
+    EStringList * files;
+    Query * used;
+    uint directory;
+
+    Query * indexes;
+    bool indexed;
+
+    uint last;
+    uint batch;
+    uint found;
+    uint started;
+
+    uint removedMessages;
+    uint removedBodyparts;
+    uint removedFiles;
+};
+
+
 static AoxFactory<Vacuum>
 f3( "vacuum", "", "Perform routine maintenance.",
-    "    Synopsis: aox vacuum\n\n"
+    "    Synopsis: aox vacuum [-afv]\n\n"
     "    Permanently deletes messages that were marked for deletion\n"
     "    more than a certain number of days ago (cf. undelete-time)\n"
     "    and removes any bodyparts that are no longer used.\n\n"
+    "    The work is done in many small transactions, so the server\n"
+    "    can go on injecting mail meanwhile, and vacuum can be\n"
+    "    interrupted and restarted at any time. (If aox tune database\n"
+    "    mostly-writing has removed the indices this needs, vacuum\n"
+    "    uses one large transaction instead.)\n\n"
+    "    The -f flag also searches the entire database for unused\n"
+    "    messages and bodyparts, e.g. after aox delete mailbox -f,\n"
+    "    and removes files in blob-store that no bodypart uses.\n"
+    "    The -a flag removes unused addresses. Both are slow and lock\n"
+    "    tables, so they aren't needed for routine vacuuming.\n\n"
+    "    The -v flag reports progress.\n\n"
     "    This is not a replacement for running VACUUM ANALYSE on the\n"
     "    database (either with vaccumdb or via autovacuum).\n\n"
     "    This command should be run (we suggest daily) via crontab.\n" );
 
 /*! \class Vacuum Vacuum.h
     This class handles the "aox vacuum" command.
+
+    Vacuum first applies the retention policies, then reclaims
+    messages in batches of a few thousand, each in its own
+    transaction. The candidates in each batch are the messages whose
+    expired deleted_messages or deliveries rows it removes. Between
+    batches Vacuum sleeps for as long as the batch took, so it never
+    uses more than half of the database's time.
+
+    Checking whether a candidate is still used needs the mm_m, dm_m
+    and pn_b indices, which "aox tune database mostly-writing" drops.
+    Without them, each batch would scan mailbox_messages,
+    deleted_messages and part_numbers, so Vacuum instead reclaims
+    everything in a single batch, with one scan of each table.
 */
 
 Vacuum::Vacuum( EStringList * args )
-    : AoxCommand( args ), t( 0 ), r( 0 ), s( 0 )
+    : AoxCommand( args ), d( new VacuumData )
 {
 }
 
 
 void Vacuum::execute()
 {
-    if ( !t ) {
+    if ( !d->t && d->step == VacuumData::Retaining ) {
         parseOptions();
         end();
 
         database( true );
         Mailbox::setup( this );
-        t = new Transaction( this );
-        uint days = Configuration::scalar( Configuration::UndeleteTime );
-
-        Query * q;
-
-        q = new Query( "delete from deliveries "
-                       "where injected_at<current_timestamp-'" +
-                       fn( days ) + " days'::interval "
-                       "and id in "
-                       "(select delivery from delivery_recipients "
-                       " where action!=$1 and action!=$2) "
-                       "and id not in "
-                       "(select delivery from delivery_recipients "
-                       " where action=$1 or action=$2)", 0 );
-        q->bind( 1, Recipient::Unknown );
-        q->bind( 2, Recipient::Delayed );
-        t->enqueue( q );
-
-        q = new Query( "delete from deleted_messages "
-                       "where deleted_at<current_timestamp-'" + fn( days ) +
-                       " days'::interval", 0 );
-        t->enqueue( q );
-
-        q = new Query( "delete from messages where id in "
-                       "(select m.id from messages m"
-                       " left join mailbox_messages mm on (m.id=mm.message)"
-                       " left join deleted_messages dm on (m.id=dm.message)"
-                       " left join deliveries d on (m.id=d.message)"
-                       " where mm.message is null and dm.message is null"
-                       " and d.message is null)", 0 );
-        t->enqueue( q );
-
-        q = new Query( "delete from bodyparts where id in (select id "
-                       "from bodyparts b left join part_numbers p on "
-                       "(b.id=p.bodypart) where bodypart is null)", 0 );
-        t->enqueue( q );
-
-        if ( opt( 'a' ) > 0 ) {
-            // delete the unnecessary addresses rows. this locks the
-            // database for quite a while (seconds, perhaps even a
-            // minute), so this isn't in the regular vacuum.
-
-            t->enqueue( "create temporary table au "
-                        "( address integer, used boolean )" );
-            // pick some candidates at random
-            t->enqueue( "insert into au (address, used) "
-                        "select id, false from addresses" );
-            // make sure noone can add new references to those rows
-            t->enqueue(
-                "select id from addresses where id in (select id from au) "
-                "for update" );
-            // create an index: the next update and last delete need it
-            t->enqueue(
-                "create index af_a on address_fields using btree(address)" );
-            // mark those addresses that are used by something
-            t->enqueue(
-                "update au set used=true from address_fields "
-                "where au.address=address_fields.address" );
-            t->enqueue(
-                "update au set used=true from aliases "
-                "where au.address=aliases.address" );
-            t->enqueue(
-                "update au set used=true from deliveries "
-                "where au.address=deliveries.sender" );
-            t->enqueue(
-                "update au set used=true from delivery_recipients "
-                "where au.address=delivery_recipients.recipient" );
-            t->enqueue(
-                "update au set used=true from autoresponses "
-                "where au.address=autoresponses.sent_from" );
-            t->enqueue(
-                "update au set used=true from autoresponses "
-                "where au.address=autoresponses.sent_to" );
-            // delete all those we know are unused
-            t->enqueue(
-                "delete from addresses where id in "
-                "(select address from au where not used)" );
-            // the index has to go away again
-            t->enqueue( "drop table au" );
-            t->enqueue( "drop index af_a" );
+
+        EStringList wanted;
+        wanted.append( "mm_m" );
+        wanted.append( "dm_m" );
+        wanted.append( "pn_b" );
+        d->indexes = new Query( "select indexname::text from pg_indexes "
+                                "where schemaname=$1 "
+                                "and indexname=any($2::text[])", this );
+        d->indexes->bind( 1,
+                          Configuration::text( Configuration::DbSchema ) );
+        d->indexes->bind( 2, wanted );
+        d->indexes->execute();
+
+        d->t = new Transaction( this );
+        d->r = new RetentionSelector( d->t, this );
+        d->r->execute();
+    }
+
+    if ( d->step == VacuumData::Retaining ) {
+        if ( !d->r->done() || !d->indexes->done() )
+            return;
+        if ( !d->s )
+            retain();
+        if ( !d->t->done() )
+            return;
+        if ( d->t->failed() )
+            error( "Applying retention policies failed: " +
+                   d->t->error() );
+        d->t = 0;
+        d->step = VacuumData::Deliveries;
+
+        if ( d->indexes->rows() < 3 ) {
+            if ( opt( 'v' ) > 0 )
+                printf( "Some indices are missing (see aox tune "
+                        "database), so vacuum will use one large "
+                        "batch.\n" );
+            d->indexed = false;
+            d->batch = 0x7fffffff;
         }
+    }
 
-        r = new RetentionSelector( t, this );
-        r->execute();
+    while ( d->step == VacuumData::Deliveries ||
+            d->step == VacuumData::Expired ) {
+        if ( d->pause && d->pause->active() )
+            return;
+        if ( !reclaim() )
+            return;
+    }
 
-        t->execute();
+    if ( d->step == VacuumData::Sweeping ) {
+        if ( !d->t && ( opt( 'f' ) > 0 || opt( 'a' ) > 0 ) )
+            sweep();
+
+        if ( d->t ) {
+            if ( !d->t->done() )
+                return;
+            if ( d->t->failed() )
+                error( "Vacuuming failed: " + d->t->error() );
+            d->t = 0;
+            if ( d->orphans )
+                d->removedMessages += d->orphans->rows();
+            if ( d->bodyparts )
+                d->removedBodyparts += d->bodyparts->rows();
+            removeBlobs();
+        }
+        d->step = VacuumData::Files;
     }
 
-    if ( !r->done() )
+    if ( d->step != VacuumData::Files )
         return;
 
-    if ( !s ) {
-        s = new Selector( Selector::And );
-        if ( r->deletes() ) {
-            s->add( r->deletes() );
-            if ( r->retains() ) {
-                Selector * n = new Selector( Selector::Not );
-                s->add( n );
-                n->add( r->retains() );
-            }
-            s->simplify();
-            EStringList wanted;
-            wanted.append( "mailbox" );
-            wanted.append( "uid" );
-            // moving stuff from mm to dm while increasing modseq
-            // appropriately and not locking unrelated mailboxes is
-            // complicated.
-
-            // make a staging table.
-            t->enqueue( new Query( "create temporary table s ("
-                                   "mailbox integer, "
-                                   "uid integer )", 0 ) );
-
-            // insert the messages to be deleted there.
-            Query * iq = s->query( 0, 0, 0, this, false, &wanted, false );
-            iq->setString( "insert into s (mailbox,uid) " + iq->string() );
-            t->enqueue( iq );
-
-            // lock all relevant mailboxes against concurrent
-            // modification.  this doesn't quite work, since something
-            // may have changed the mailbox concurrently with the
-            // insert above. but it'll lock at least as many mailboxes
-            // as we need, and very seldom any extra ones.
-            t->enqueue( new Query( "select nextmodseq from mailboxes "
-                                   "join s on (mailboxes.id=s.mailbox) "
-                                   "order by id "
-                                   "for update", 0 ) );
-
-            // insert those messages which still exist into dm. we
-            // join against mm just in case someone deleted one of
-            // those messages while the insert was running.
-            t->enqueue( new Query( "insert into deleted_messages "
-                                   "(mailbox, uid, message,"
-                                   " modseq, deleted_by, reason) "
-                                   "select s.mailbox, s.uid, mm.message,"
-                                   " m.nextmodseq, null, 'Retention policy' "
-                                   "from s "
-                                   "join mailbox_messages mm"
-                                   " using (mailbox,uid) "
-                                   "join mailboxes m on (s.mailbox=m.id)",
-                                   0 ) );
-
-            // consume a modseq for each mailbox we (may have) modified.
-            t->enqueue( new Query( "update mailboxes "
-                                   "set nextmodseq=nextmodseq+1 "
-                                   "where id in (select mailbox from s)",
-                                   0 ) );
-
-            // we don't need the staging table any more
-            t->enqueue( new Query( "drop table s", 0 ) );
-
-            // but we do need to notify the running server of the change
-            t->enqueue( new Query( "notify mailboxes_updated", 0 ) );
+    if ( opt( 'f' ) > 0 && BlobStore::enabled() && !sweepFiles() )
+        return;
+
+    d->step = VacuumData::Done;
+
+    if ( opt( 'v' ) > 0 )
+        printf( "Removed %u messages, %u bodyparts and %u files.\n",
+                d->removedMessages, d->removedBodyparts, d->removedFiles );
+
+    finish();
+}
+
+
+/*! Moves the messages the retention policies say should go into
+    deleted_messages, and commits. They'll be removed for good by a
+    later vacuum, after undelete-time.
+*/
+
+void Vacuum::retain()
+{
+    d->s = new Selector( Selector::And );
+    if ( d->r->deletes() ) {
+        d->s->add( d->r->deletes() );
+        if ( d->r->retains() ) {
+            Selector * n = new Selector( Selector::Not );
+            d->s->add( n );
+            n->add( d->r->retains() );
         }
+        d->s->simplify();
+        EStringList wanted;
+        wanted.append( "mailbox" );
+        wanted.append( "uid" );
+        // moving stuff from mm to dm while increasing modseq
+        // appropriately and not locking unrelated mailboxes is
+        // complicated.
+
+        // make a staging table.
+        d->t->enqueue( new Query( "create temporary table s ("
+                                  "mailbox integer, "
+                                  "uid integer )", 0 ) );
+
+        // insert the messages to be deleted there.
+        Query * iq = d->s->query( 0, 0, 0, this, false, &wanted, false );
+        iq->setString( "insert into s (mailbox,uid) " + iq->string() );
+        d->t->enqueue( iq );
+
+        // lock all relevant mailboxes against concurrent
+        // modification.  this doesn't quite work, since something
+        // may have changed the mailbox concurrently with the
+        // insert above. but it'll lock at least as many mailboxes
+        // as we need, and very seldom any extra ones.
+        d->t->enqueue( new Query( "select nextmodseq from mailboxes "
+                                  "join s on (mailboxes.id=s.mailbox) "
+                                  "order by id "
+                                  "for update", 0 ) );
+
+        // insert those messages which still exist into dm. we
+        // join against mm just in case someone deleted one of
+        // those messages while the insert was running.
+        d->t->enqueue( new Query( "insert into deleted_messages "
+                                  "(mailbox, uid, message,"
+                                  " modseq, deleted_by, reason) "
+                                  "select s.mailbox, s.uid, mm.message,"
+                                  " m.nextmodseq, null, 'Retention policy' "
+                                  "from s "
+                                  "join mailbox_messages mm"
+                                  " using (mailbox,uid) "
+                                  "join mailboxes m on (s.mailbox=m.id)",
+                                  0 ) );
+
+        // consume a modseq for each mailbox we (may have) modified.
+        d->t->enqueue( new Query( "update mailboxes "
+                                  "set nextmodseq=nextmodseq+1 "
+                                  "where id in (select mailbox from s)",
+                                  0 ) );
+
+        // we don't need the staging table any more
+        d->t->enqueue( new Query( "drop table s", 0 ) );
+
+        // but we do need to notify the running server of the change
+        d->t->enqueue( new Query( "notify mailboxes_updated", 0 ) );
+    }
 
-        t->commit();
+    d->t->commit();
+}
+
+
+/*! Reclaims one batch of messages and the bodyparts only they used,
+    and returns true once that batch is committed. Returns false while
+    there's still work to do on the batch.
+
+    The first batches remove old deliveries, the later ones expired
+    deleted_messages rows. Each batch continues where the last one
+    left off, in order of id, so that the database doesn't have to
+    step over the dead rows left by earlier batches.
+*/
+
+bool Vacuum::reclaim()
+{
+    uint days = Configuration::scalar( Configuration::UndeleteTime );
+    EString cutoff = "current_timestamp-'" + fn( days ) + " days'::interval";
+
+    if ( !d->t ) {
+        d->t = new Transaction( this );
+        d->started = (uint)time( 0 );
+        d->parts = 0;
+        d->orphans = 0;
+        d->bodyparts = 0;
+        d->blobs = 0;
+        if ( d->step == VacuumData::Deliveries ) {
+            d->find = new Query( "select id, message from deliveries "
+                                 "where id>$3 and injected_at<" + cutoff +
+                                 " and id in "
+                                 "(select delivery from delivery_recipients "
+                                 " where action!=$1 and action!=$2) "
+                                 "and id not in "
+                                 "(select delivery from delivery_recipients "
+                                 " where action=$1 or action=$2) "
+                                 "order by id limit $4", this );
+            d->find->bind( 1, Recipient::Unknown );
+            d->find->bind( 2, Recipient::Delayed );
+            d->find->bind( 3, d->last );
+            d->find->bind( 4, d->batch );
+        }
+        else {
+            d->find = new Query( "select message as id, message "
+                                 "from deleted_messages "
+                                 "where message>$1 and deleted_at<" +
+                                 cutoff + " "
+                                 "order by message limit $2", this );
+            d->find->bind( 1, d->last );
+            d->find->bind( 2, d->batch );
+        }
+        d->t->enqueue( d->find );
+        d->t->execute();
     }
 
-    if ( !t->done() )
-        return;
+    if ( !d->find->done() )
+        return false;
 
-    if ( t->failed() )
-        error( "Vacuuming failed" );
+    if ( !d->orphans ) {
+        IntegerSet ids;
+        IntegerSet messages;
+        d->found = 0;
+        while ( d->find->hasResults() ) {
+            Row * r = d->find->nextRow();
+            ids.add( r->getInt( "id" ) );
+            messages.add( r->getInt( "message" ) );
+            d->found++;
+        }
+        if ( !ids.isEmpty() ) {
+            d->last = ids.largest();
+            Query * q;
+            if ( d->step == VacuumData::Deliveries )
+                q = new Query( "delete from deliveries where id=any($1)",
+                               0 );
+            else
+                q = new Query( "delete from deleted_messages "
+                               "where message=any($1) "
+                               "and deleted_at<" + cutoff, 0 );
+            q->bind( 1, ids );
+            d->t->enqueue( q );
+
+            // the part_numbers rows go with the messages, so we
+            // note which bodyparts they use first
+            d->parts = new Query( "select distinct bodypart "
+                                  "from part_numbers "
+                                  "where message=any($1) "
+                                  "and bodypart is not null", this );
+            d->parts->bind( 1, messages );
+            d->t->enqueue( d->parts );
+        }
+        d->orphans = new Query( "delete from messages where id=any($1) "
+                                "and not exists "
+                                "(select message from mailbox_messages"
+                                " where message=messages.id) "
+                                "and not exists "
+                                "(select message from deleted_messages"
+                                " where message=messages.id) "
+                                "and not exists "
+                                "(select message from deliveries"
+                                " where message=messages.id)", this );
+        d->orphans->bind( 1, messages );
+        d->t->enqueue( d->orphans );
+        d->t->execute();
+    }
 
-    finish();
+    if ( !d->orphans->done() )
+        return false;
+
+    if ( !d->bodyparts ) {
+        IntegerSet bodyparts;
+        while ( d->parts && d->parts->hasResults() )
+            bodyparts.add( d->parts->nextRow()->getInt( "bodypart" ) );
+        if ( BlobStore::enabled() && !bodyparts.isEmpty() ) {
+            // find the blob-store files that will be unused once the
+            // bodyparts rows below are gone. we delete them after
+            // committing.
+            d->blobs = new Query( "select distinct b.blob from bodyparts b "
+                                  "where b.id=any($1) "
+                                  "and b.blob is not null "
+                                  "and not exists "
+                                  "(select b2.id from bodyparts b2 "
+                                  "join part_numbers p on "
+                                  "(b2.id=p.bodypart) "
+                                  "where b2.blob=b.blob)", 0 );
+            d->blobs->bind( 1, bodyparts );
+            d->t->enqueue( d->blobs );
+        }
+        d->bodyparts = new Query( "delete from bodyparts where id=any($1) "
+                                  "and not exists "
+                                  "(select bodypart from part_numbers"
+                                  " where bodypart=bodyparts.id)", this );
+        d->bodyparts->bind( 1, bodyparts );
+        d->t->enqueue( d->bodyparts );
+        d->t->commit();
+    }
+
+    if ( !d->t->done() )
+        return false;
+
+    if ( d->t->failed() )
+        error( "Vacuuming failed: " + d->t->error() );
+    d->t = 0;
+
+    d->removedMessages += d->orphans->rows();
+    d->removedBodyparts += d->bodyparts->rows();
+    removeBlobs();
+
+    if ( opt( 'v' ) > 1 )
+        printf( "Removed %u messages and %u bodyparts so far.\n",
+                d->removedMessages, d->removedBodyparts );
+
+    if ( d->found < d->batch ) {
+        d->last = 0;
+        if ( d->step == VacuumData::Deliveries )
+            d->step = VacuumData::Expired;
+        else
+            d->step = VacuumData::Sweeping;
+    }
+
+    // aim for batches of one to four seconds, and rest as long as
+    // the batch took, so that injection gets its share of the
+    // database.
+    uint elapsed = (uint)time( 0 ) - d->started;
+    if ( !d->indexed )
+        return true;
+    if ( elapsed < 1 && d->batch < 16384 )
+        d->batch = d->batch * 2;
+    else if ( elapsed > 4 && d->batch > 64 )
+        d->batch = d->batch / 2;
+    if ( elapsed > 0 && d->step != VacuumData::Sweeping )
+        d->pause = new Timer( this, elapsed );
+
+    return true;
+}
+
+
+/*! Searches the entire database for unused messages and bodyparts
+    (if -f was given) and addresses (if -a was), in one transaction.
+*/
+
+void Vacuum::sweep()
+{
+    d->t = new Transaction( this );
+    d->orphans = 0;
+    d->bodyparts = 0;
+    d->blobs = 0;
+
+    if ( opt( 'f' ) > 0 ) {
+        d->orphans = new Query( "delete from messages where id in "
+                                "(select m.id from messages m"
+                                " left join mailbox_messages mm"
+                                " on (m.id=mm.message)"
+                                " left join deleted_messages dm"
+                                " on (m.id=dm.message)"
+                                " left join deliveries d"
+                                " on (m.id=d.message)"
+                                " where mm.message is null"
+                                " and dm.message is null"
+                                " and d.message is null)", 0 );
+        d->t->enqueue( d->orphans );
+
+        if ( BlobStore::enabled() ) {
+            d->started = (uint)time( 0 );
+            d->blobs = new Query( "select distinct b.blob from bodyparts b "
+                                  "left join part_numbers p on "
+                                  "(b.id=p.bodypart) "
+                                  "where p.bodypart is null "
+                                  "and b.blob is not null "
+                                  "and not exists "
+                                  "(select b2.id from bodyparts b2 "
+                                  "join part_numbers p2 on "
+                                  "(b2.id=p2.bodypart) "
+                                  "where b2.blob=b.blob)", 0 );
+            d->t->enqueue( d->blobs );
+        }
+
+        d->bodyparts = new Query( "delete from bodyparts where id in "
+                                  "(select id from bodyparts b "
+                                  "left join part_numbers p on "
+                                  "(b.id=p.bodypart) "
+                                  "where bodypart is null)", 0 );
+        d->t->enqueue( d->bodyparts );
+    }
+
+    if ( opt( 'a' ) > 0 ) {
+        // delete the unnecessary addresses rows. this locks the
+        // database for quite a while (seconds, perhaps even a
+        // minute), so this isn't in the regular vacuum.
+
+        d->t->enqueue( "create temporary table au "
+                       "( address integer, used boolean )" );
+        // pick some candidates at random
+        d->t->enqueue( "insert into au (address, used) "
+                       "select id, false from addresses" );
+        // make sure noone can add new references to those rows
+        d->t->enqueue(
+            "select id from addresses where id in (select id from au) "
+            "for update" );
+        // create an index: the next update and last delete need it
+        d->t->enqueue(
+            "create index af_a on address_fields using btree(address)" );
+        // mark those addresses that are used by something
+        d->t->enqueue(
+            "update au set used=true from address_fields "
+            "where au.address=address_fields.address" );
+        d->t->enqueue(
+            "update au set used=true from aliases "
+            "where au.address=aliases.address" );
+        d->t->enqueue(
+            "update au set used=true from deliveries "
+            "where au.address=deliveries.sender" );
+        d->t->enqueue(
+            "update au set used=true from delivery_recipients "
+            "where au.address=delivery_recipients.recipient" );
+        d->t->enqueue(
+            "update au set used=true from autoresponses "
+            "where au.address=autoresponses.sent_from" );
+        d->t->enqueue(
+            "update au set used=true from autoresponses "
+            "where au.address=autoresponses.sent_to" );
+        // delete all those we know are unused
+        d->t->enqueue(
+            "delete from addresses where id in "
+            "(select address from au where not used)" );
+        // the index has to go away again
+        d->t->enqueue( "drop table au" );
+        d->t->enqueue( "drop index af_a" );
+    }
+
+    d->t->commit();
+}
+
+
+/*! Removes the files in blob-store which no bodyparts row refers to,
+    checking one of the store's 256 parts at a time, and returns true
+    when all parts have been checked. Returns false while there's
+    still work to do.
+
+    Files that were stored or reused during the past hour are left
+    alone, since an Injector may be about to commit a row referring
+    to them.
+*/
+
+bool Vacuum::sweepFiles()
+{
+    while ( d->directory < 256 || d->used ) {
+        if ( !d->used ) {
+            d->files = BlobStore::list( d->directory++ );
+            if ( d->files->isEmpty() )
+                continue;
+            d->started = (uint)time( 0 );
+            d->used = new Query( "select blob from bodyparts "
+                                 "where blob=any($1)", this );
+            d->used->bind( 1, *d->files );
+            d->used->execute();
+        }
+
+        if ( !d->used->done() )
+            return false;
+        if ( d->used->failed() )
+            error( "Could not look for unused files: " +
+                   d->used->error() );
+
+        Dict<void> used;
+        while ( d->used->hasResults() )
+            used.insert( d->used->nextRow()->getEString( "blob" ),
+                         (void*)1 );
+        EStringList::Iterator i( d->files );
+        while ( i ) {
+            if ( !used.contains( *i ) &&
+                 BlobStore::remove( *i, d->started - 3600 ) )
+                d->removedFiles++;
+            ++i;
+        }
+        d->used = 0;
+        d->files = 0;
+    }
+    return true;
+}
+
+
+/*! Removes the blob-store files found to be unused by the last
+    transaction, which must have committed.
+
+    An injector may have decided to reuse a file just before we
+    deleted its last row, so we leave alone files that were used
+    during the hour before the transaction started.
+*/
+
+void Vacuum::removeBlobs()
+{
+    while ( d->blobs && d->blobs->hasResults() ) {
+        if ( BlobStore::remove( d->blobs->nextRow()->getEString( "blob" ),
+                                d->started - 3600 ) )
+            d->removedFiles++;
+    }
+    d->blobs = 0;
 }
 
 
@@ -38,9 +38,12 @@ public:
     void execute();
 
 private:
-    class Transaction * t;
-    class RetentionSelector * r;
-    class Selector * s;
+    class VacuumData * d;
+    void retain();
+    bool reclaim();
+    void sweep();
+    bool sweepFiles();
+    void removeBlobs();
 };
 
 
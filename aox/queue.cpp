@@ -179,7 +179,10 @@ void FlushQueue::execute()
         t->enqueue( new Query( "update delivery_recipients "
                                "set last_attempt=null "
                                "where action=2", 0 ) );
-        t->enqueue( new Query( "notify deliveries_updated", 0 ) );
+        t->enqueue( new Query( "update deliveries "
+                               "set next_attempt=current_timestamp "
+                               "where next_attempt is not null", 0 ) );
+        t->enqueue( new Query( "notify deliveries_flushed", 0 ) );
         t->commit();
     }
 
@@ -7,6 +7,8 @@
 #include "message.h"
 #include "mailbox.h"
 #include "injector.h"
+#include "blobstore.h"
+#include "compressor.h"
 #include "integerset.h"
 #include "transaction.h"
 
@@ -62,7 +64,8 @@ void Reparse::execute()
         d->q = new Query( "select mm.mailbox, mm.uid, mm.modseq, "
                           "mm.message as wrapper, "
                           "mb.nextmodseq, "
-                          "b.id as bodypart, b.text, b.data "
+                          "b.id as bodypart, b.text, b.data, b.blob, "
+                          "b.compression "
                           "from unparsed_messages u "
                           "join bodyparts b on (u.bodypart=b.id) "
                           "join part_numbers p on (p.bodypart=b.id) "
@@ -88,10 +91,18 @@ void Reparse::execute()
         Row * r = d->q->nextRow();
 
         EString text;
-        if ( r->isNull( "data" ) )
-            text = r->getEString( "text" );
-        else
+        if ( !r->isNull( "data" ) && !r->isNull( "compression" ) )
+            text = Compressor::decompress( r->getEString( "data" ),
+                                           r->getInt( "compression" ) );
+        else if ( !r->isNull( "data" ) )
             text = r->getEString( "data" );
+        else if ( !r->isNull( "blob" ) ) {
+            text = BlobStore::fetch( r->getEString( "blob" ) );
+            if ( text.isEmpty() )
+                continue; // leave it alone; it may be readable later
+        }
+        else
+            text = r->getEString( "text" );
         Mailbox * mb = Mailbox::find( r->getInt( "mailbox" ) );
         Injectee * im = new Injectee;
         im->parse( text );
@@ -41,11 +41,18 @@ int main( int ac, char ** av )
 
     Configuration::report();
 
+    EString output;
+    EString maildir;
+    uint shards = 1;
+    uint parallel = 2;
+
     int i = 1;
     while( i < ac && *av[i] == '-' ) {
         uint j = 1;
+        int next = i + 1;
         while ( av[i][j] ) {
-            switch( av[i][j] ) {
+            char o = av[i][j];
+            switch( o ) {
             case 'v':
                 verbosity++;
                 break;
@@ -53,15 +60,42 @@ int main( int ac, char ** av )
                 if ( verbosity )
                     verbosity--;
                 break;
+            case 'o':
+            case 'd':
+            case 's':
+            case 'p':
+                if ( next < ac ) {
+                    EString a( av[next++] );
+                    bool ok = true;
+                    if ( o == 'o' )
+                        output = a;
+                    else if ( o == 'd' )
+                        maildir = a;
+                    else if ( o == 's' )
+                        shards = a.number( &ok );
+                    else
+                        parallel = a.number( &ok );
+                    if ( !ok )
+                        bad = true;
+                }
+                else {
+                    bad = true;
+                }
+                break;
             default:
                 bad = true;
                 break;
             }
             j++;
         }
-        i++;
+        i = next;
     }
 
+    if ( shards > 1 && output.isEmpty() )
+        bad = true;
+    if ( !maildir.isEmpty() && !output.isEmpty() )
+        bad = true;
+
     Utf8Codec c;
     UString source;
     if ( i >= ac )
@@ -82,7 +116,13 @@ int main( int ac, char ** av )
 
     if ( bad ) {
         fprintf( stderr,
-                 "Usage: %s [-vq] [mailbox] [search]"
+                 "Usage: %s [-vq] [-o file [-s shards] | -d maildir] "
+                 "[-p batches] [mailbox] [search]\n"
+                 "  -o file     Write mbox output to file, not stdout.\n"
+                 "  -s shards   Spread it over file.0, file.1 etc.\n"
+                 "  -d maildir  Write a maildir instead of mbox output.\n"
+                 "  -p batches  Fetch that many pages at once "
+                 "(default 2).\n"
                  "See aoxexport(8) or "
                  "http://aox.org/aoxexport/ for details.\n", av[0] );
         exit( -1 );
@@ -100,6 +140,11 @@ int main( int ac, char ** av )
     Database::setup();
 
     Exporter * e = new Exporter( source, which );
+    if ( !maildir.isEmpty() )
+        e->setMaildir( maildir );
+    else if ( !output.isEmpty() )
+        e->setOutput( output, shards );
+    e->setParallelism( parallel );
 
     Mailbox::setup( e );
 
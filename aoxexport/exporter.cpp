@@ -2,6 +2,7 @@
 
 #include "exporter.h"
 
+#include "allocator.h"
 #include "eventloop.h"
 #include "selector.h"
 #include "address.h"
@@ -13,7 +14,12 @@
 #include "list.h"
 #include "map.h"
 
-#include <unistd.h> // write()
+#include <sys/stat.h> // mkdir()
+#include <sys/types.h>
+#include <unistd.h> // write(), unlink()
+#include <stdio.h> // rename()
+#include <fcntl.h> // open()
+#include <errno.h>
 
 
 class ExporterData
@@ -21,17 +27,38 @@ class ExporterData
 {
 public:
     ExporterData()
-        : find( 0 ), fetcher( 0 ),
+        : find( 0 ), lastMailbox( 0 ), lastUid( 0 ), exhausted( false ),
           mailbox( 0 ), selector( 0 ),
-          messages( new List<Message> )
+          pageSize( 1024 ), parallel( 2 ),
+          shards( 1 ), fds( 0 )
         {}
 
+    class Batch
+        : public Garbage
+    {
+    public:
+        Batch(): messages( new List<Message> ), fetcher( 0 ) {}
+        List<Message> * messages;
+        Fetcher * fetcher;
+    };
+
     Query * find;
-    Fetcher * fetcher;
+    uint lastMailbox;
+    uint lastUid;
+    bool exhausted;
+    List<Batch> batches;
+
     UString sourceName;
     Mailbox * mailbox;
     Selector * selector;
-    List<Message> * messages;
+
+    uint pageSize;
+    uint parallel;
+
+    EString output;
+    EString maildir;
+    uint shards;
+    int * fds;
 };
 
 
@@ -43,6 +70,16 @@ static const char * weekdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu",
                                    "Fri", "Sat" };
 
 
+/*! \class Exporter exporter.h
+    Writes the messages matching a Selector in mbox or maildir format.
+
+    The Exporter never holds more than a few batches of messages in
+    RAM, so it can export mailboxes of any size. It walks the matching
+    messages in order of mailbox and uid, a page at a time, and
+    fetches the next few pages while it writes the current one.
+*/
+
+
 /*! Constructs an Exporter object which will read those messages in \a
     source which match \a selector and write them to stdout.
 
@@ -61,6 +98,44 @@ Exporter::Exporter( const UString & source, Selector * selector )
 }
 
 
+/*! Instructs this Exporter to write mbox output to \a file instead of
+    stdout. If \a shards is greater than 1, the messages are spread
+    over that many files, called \a file.0, \a file.1 and so on.
+*/
+
+void Exporter::setOutput( const EString & file, uint shards )
+{
+    d->output = file;
+    d->shards = shards;
+    if ( !d->shards )
+        d->shards = 1;
+}
+
+
+/*! Instructs this Exporter to write a maildir in \a directory instead
+    of mbox output. The directory and its tmp, new and cur
+    subdirectories are created if necessary.
+*/
+
+void Exporter::setMaildir( const EString & directory )
+{
+    d->maildir = directory;
+}
+
+
+/*! Instructs this Exporter to fetch up to \a n batches of messages at
+    once. The default is 2, so that one batch is fetched while the
+    previous one is written.
+*/
+
+void Exporter::setParallelism( uint n )
+{
+    d->parallel = n;
+    if ( !d->parallel )
+        d->parallel = 1;
+}
+
+
 void Exporter::execute()
 {
     if ( Mailbox::refreshing() ) {
@@ -77,91 +152,245 @@ void Exporter::execute()
         }
     }
 
-    if ( !d->find ) {
-        EStringList wanted;
-        wanted.append( "message" );
-        d->find = d->selector->query( 0, d->mailbox, 0, this,
-                                      true, &wanted, false );
-        d->find->execute();
+    if ( !d->fds && !open() )
+        return;
+
+    bool progress = true;
+    while ( progress ) {
+        progress = false;
+
+        if ( d->find && d->find->done() ) {
+            ExporterData::Batch * b = new ExporterData::Batch;
+            while ( d->find->hasResults() ) {
+                Row * r = d->find->nextRow();
+                Message * m = new Message;
+                m->setDatabaseId( r->getInt( "message" ) );
+                b->messages->append( m );
+                d->lastMailbox = r->getInt( "mailbox" );
+                d->lastUid = r->getInt( "uid" );
+            }
+            if ( d->find->failed() ) {
+                log( "Could not find messages: " + d->find->error(),
+                     Log::Disaster );
+                return;
+            }
+            if ( b->messages->count() < d->pageSize )
+                d->exhausted = true;
+            d->find = 0;
+            if ( !b->messages->isEmpty() ) {
+                b->fetcher = new Fetcher( b->messages, this, 0 );
+                b->fetcher->fetch( Fetcher::Addresses );
+                b->fetcher->fetch( Fetcher::OtherHeader );
+                b->fetcher->fetch( Fetcher::Body );
+                b->fetcher->fetch( Fetcher::Trivia );
+                b->fetcher->execute();
+                d->batches.append( b );
+            }
+            progress = true;
+        }
+
+        if ( !d->find && !d->exhausted &&
+             d->batches.count() < d->parallel ) {
+            findMore();
+            progress = true;
+        }
+
+        while ( !d->batches.isEmpty() ) {
+            ExporterData::Batch * b = d->batches.firstElement();
+            while ( !b->messages->isEmpty() ) {
+                Message * m = b->messages->firstElement();
+                if ( !m->hasAddresses() || !m->hasHeaders() ||
+                     !m->hasBodies() || !m->hasTrivia() )
+                    break;
+                b->messages->shift();
+                if ( m->valid() )
+                    write( m );
+                else
+                    log( "Cannot export message " +
+                         fn( m->databaseId() ) + ": " + m->error(),
+                         Log::Error );
+            }
+            if ( !b->messages->isEmpty() )
+                break;
+            d->batches.shift();
+            progress = true;
+        }
     }
 
-    if ( !d->find->done() )
+    if ( !d->exhausted || d->find || !d->batches.isEmpty() )
         return;
 
-    if ( !d->fetcher ) {
-        d->messages = new List<Message>;
-        while ( d->find->hasResults() ) {
-            Row * r = d->find->nextRow();
-            Message * m = new Message;
-            m->setDatabaseId( r->getInt( "message" ) );
-            d->messages->append( m );
+    uint i = 0;
+    while ( d->fds && i < d->shards ) {
+        if ( d->fds[i] > 1 )
+            ::close( d->fds[i] );
+        i++;
+    }
+    EventLoop::global()->stop();
+}
+
+
+/*! Starts a query for the next page of matching messages, which is
+    the first pageSize messages after the last one found so far, in
+    order of mailbox and uid.
+
+    Selector::setPage() adds the condition to the selector's own
+    query, so that the database can start each page with an index
+    lookup on the primary key of mailbox_messages. Wrapping the
+    selector's query in a subselect instead would make the database
+    find all the matching messages again for every page.
+*/
+
+void Exporter::findMore()
+{
+    EStringList wanted;
+    wanted.append( "mailbox" );
+    wanted.append( "uid" );
+    wanted.append( "message" );
+    d->selector->setPage( d->pageSize, d->lastMailbox, d->lastUid );
+    d->find = d->selector->query( 0, d->mailbox, 0, this,
+                                  false, &wanted, false );
+    d->find->execute();
+}
+
+
+/*! Opens the output files or creates the maildir, and returns true if
+    that worked. Logs a disaster and returns false if not.
+*/
+
+bool Exporter::open()
+{
+    d->fds = (int*)Allocator::alloc( d->shards * sizeof( int ), 0 );
+
+    if ( !d->maildir.isEmpty() ) {
+        d->shards = 0;
+        const char * subdirs[] = { "", "/tmp", "/new", "/cur" };
+        uint i = 0;
+        while ( i < 4 ) {
+            EString dir = d->maildir + subdirs[i];
+            if ( ::mkdir( dir.cstr(), 0700 ) < 0 && errno != EEXIST ) {
+                log( "Cannot create " + dir, Log::Disaster );
+                return false;
+            }
+            i++;
         }
-        d->fetcher = new Fetcher( d->messages, this, 0 );
-        d->fetcher->fetch( Fetcher::Addresses );
-        d->fetcher->fetch( Fetcher::OtherHeader );
-        d->fetcher->fetch( Fetcher::Body );
-        d->fetcher->fetch( Fetcher::Trivia );
-        d->fetcher->execute();
+        return true;
     }
 
-    while ( !d->messages->isEmpty() ) {
-        Message * m = d->messages->firstElement();
-        if ( !m->hasAddresses() )
-            return;
-        if ( !m->hasHeaders() )
-            return;
-        if ( !m->hasBodies() )
-            return;
-        if ( !m->hasTrivia() )
-            return;
-        d->messages->shift();
-        EString from = "From ";
-        Header * h = m->header();
-        List<Address> * rp = 0;
-        if ( h ) {
-            rp = h->addresses( HeaderField::ReturnPath );
-            if ( !rp )
-                rp = h->addresses( HeaderField::Sender );
-            if ( !rp )
-                rp = h->addresses( HeaderField::From );
+    if ( d->output.isEmpty() ) {
+        d->shards = 1;
+        d->fds[0] = 1;
+        return true;
+    }
+
+    uint i = 0;
+    while ( i < d->shards ) {
+        EString name = d->output;
+        if ( d->shards > 1 )
+            name.append( "." + fn( i ) );
+        d->fds[i] = ::open( name.cstr(), O_WRONLY|O_CREAT|O_TRUNC, 0600 );
+        if ( d->fds[i] < 0 ) {
+            log( "Cannot open " + name + " for writing", Log::Disaster );
+            return false;
         }
-        if ( rp )
-            from.append( rp->firstElement()->lpdomain() );
-        else
-            from.append( "invalid@invalid.invalid" );
-        from.append( "  " );
-        Date id;
-        if ( m->internalDate() )
-            id.setUnixTime( m->internalDate() );
-        else if ( m->header()->date() )
-            id = *m->header()->date();
-        // Tue Jul 23 19:39:23 2002
-        from.append( weekdays[id.weekday()] );
-        from.append( " " );
-        from.append( months[id.month()-1] );
-        from.append( " " );
-        from.appendNumber( id.day() );
-        from.append( " " );
-        from.appendNumber( id.hour() );
-        from.append( ":" );
-        if ( id.minute() < 10 )
-            from.append( "0" );
-        from.appendNumber( id.minute() );
-        from.append( ":" );
-        if ( id.second() < 10 )
-            from.append( "0" );
-        from.appendNumber( id.second() );
-        from.append( " " );
-        from.appendNumber( id.year() );
-        from.append( "\r\n" );
-        EString rfc822 = m->rfc822();
-        int r = ::write( 1, from.data(), from.length() ) +
-                ::write( 1, rfc822.data(), rfc822.length() );
-        // we don't really care whether the write succeeds or not, so
-        // just fool the compiler.
-        r = r;
+        i++;
     }
+    return true;
+}
 
-    EventLoop::global()->stop();
+
+/*! Returns a suitable mbox "From " line for \a m. */
+
+static EString fromLine( Message * m )
+{
+    EString from = "From ";
+    Header * h = m->header();
+    List<Address> * rp = 0;
+    if ( h ) {
+        rp = h->addresses( HeaderField::ReturnPath );
+        if ( !rp )
+            rp = h->addresses( HeaderField::Sender );
+        if ( !rp )
+            rp = h->addresses( HeaderField::From );
+    }
+    if ( rp )
+        from.append( rp->firstElement()->lpdomain() );
+    else
+        from.append( "invalid@invalid.invalid" );
+    from.append( "  " );
+    Date id;
+    if ( m->internalDate() )
+        id.setUnixTime( m->internalDate() );
+    else if ( m->header()->date() )
+        id = *m->header()->date();
+    // Tue Jul 23 19:39:23 2002
+    from.append( weekdays[id.weekday()] );
+    from.append( " " );
+    from.append( months[id.month()-1] );
+    from.append( " " );
+    from.appendNumber( id.day() );
+    from.append( " " );
+    from.appendNumber( id.hour() );
+    from.append( ":" );
+    if ( id.minute() < 10 )
+        from.append( "0" );
+    from.appendNumber( id.minute() );
+    from.append( ":" );
+    if ( id.second() < 10 )
+        from.append( "0" );
+    from.appendNumber( id.second() );
+    from.append( " " );
+    from.appendNumber( id.year() );
+    from.append( "\r\n" );
+    return from;
 }
 
+
+/*! Writes \a m to the maildir or to the right mbox file. */
+
+void Exporter::write( Message * m )
+{
+    EString rfc822 = m->rfc822();
+    int r = 0;
+
+    if ( !d->maildir.isEmpty() ) {
+        // maildir readers may look at new/ at any time, so the file
+        // is written in tmp/ and moved when it's complete.
+        EString name = fn( m->internalDate() ) + "." +
+                       fn( m->databaseId() ) + ".aoxexport";
+        EString tmp = d->maildir + "/tmp/" + name;
+        int fd = ::open( tmp.cstr(), O_WRONLY|O_CREAT|O_TRUNC, 0600 );
+        if ( fd < 0 ) {
+            log( "Cannot write " + tmp, Log::Error );
+            return;
+        }
+        uint done = 0;
+        while ( done < rfc822.length() ) {
+            r = ::write( fd, rfc822.data() + done,
+                         rfc822.length() - done );
+            if ( r <= 0 )
+                break;
+            done += r;
+        }
+        bool ok = done == rfc822.length();
+        if ( ::close( fd ) < 0 )
+            ok = false;
+        if ( ok && ::rename( tmp.cstr(),
+                             ( d->maildir + "/new/" + name ).cstr() ) < 0 )
+            ok = false;
+        if ( !ok ) {
+            log( "Cannot write " + tmp, Log::Error );
+            ::unlink( tmp.cstr() );
+        }
+        return;
+    }
+
+    EString from = fromLine( m );
+    int fd = d->fds[m->databaseId() % d->shards];
+    r = ::write( fd, from.data(), from.length() ) +
+        ::write( fd, rfc822.data(), rfc822.length() );
+
+    // we don't really care whether the write succeeds or not, so
+    // just fool the compiler.
+    r = r;
+}
@@ -5,6 +5,8 @@
 
 #include "event.h"
 
+class Message;
+class EString;
 class Selector;
 class UString;
 
@@ -15,10 +17,18 @@ class Exporter
 public:
     Exporter( const UString &, Selector * );
 
+    void setOutput( const EString &, uint );
+    void setMaildir( const EString & );
+    void setParallelism( uint );
+
     void execute();
 
 private:
     class ExporterData * d;
+
+    void findMore();
+    bool open();
+    void write( Message * );
 };
 
 #endif
@@ -12,6 +12,8 @@
 #include <unistd.h>
 // strlen, memmove
 #include <string.h>
+// clock
+#include <time.h>
 
 #include <zlib.h>
 
@@ -39,7 +41,7 @@ static char buffer[bufsiz];
 /*! Creates an empty Buffer. */
 
 Buffer::Buffer()
-    : filter( None ), zs( 0 ),
+    : filter( None ), zs( 0 ), level( 0 ), zin( 0 ), zout( 0 ), ztime( 0 ),
       firstused( 0 ), firstfree( 0 ),
       bytes( 0 )
 {
@@ -55,6 +57,39 @@ void Buffer::append( const char * s, uint l )
 }
 
 
+/*! Returns true if the \a l bytes at \a s look as though they've
+    been compressed already, so that deflating them again would only
+    waste CPU.
+
+    Looks at a sample from the middle of \a s, and considers it
+    compressed if it uses most of the 256 possible byte values about
+    equally often. Text, base64 and most uncompressed binary formats
+    are far more skewed than that.
+*/
+
+static bool incompressible( const char * s, uint l )
+{
+    if ( l < 4096 )
+        return false;
+    uint n = 4096;
+    const unsigned char * p = (const unsigned char *)s + ( l - n ) / 2;
+    uint counts[256];
+    memset( counts, 0, sizeof( counts ) );
+    uint i = 0;
+    while ( i < n )
+        counts[p[i++]]++;
+    // the sum of the squares is about n*n/256 for random data, and
+    // n*n/64 for base64.
+    uint sum = 0;
+    i = 0;
+    while ( i < 256 ) {
+        sum += counts[i] * counts[i];
+        i++;
+    }
+    return sum < n * n / 128;
+}
+
+
 /*! This private helper is the only way to actually write data into
     the Buffer. read() and append() always call this.
 
@@ -63,15 +98,26 @@ void Buffer::append( const char * s, uint l )
     then all of \a s is pushed through zlib, while if \a f is false,
     zlib is given the option of looking at later input to compress
     better.
+
+    When compressing, data that's compressed already (e.g. a JPEG
+    sent using BINARY) is passed through as stored blocks.
 */
 
 void Buffer::append( const char * s, uint l, bool f )
 {
     int r = Z_OK;
     bool progress = true;
+    bool stored = false;
+    clock_t started = 0;
+    uint before = bytes;
 
     switch ( filter ) {
     case Compressing:
+        started = clock();
+        if ( level && incompressible( s, l ) ) {
+            deflateLevel( 0 );
+            stored = true;
+        }
         zs->avail_in = l;
         zs->next_in = (Bytef*)s;
         while ( zs->avail_in && progress && r == Z_OK ) {
@@ -93,6 +139,11 @@ void Buffer::append( const char * s, uint l, bool f )
         if ( zs->avail_in ) {
             // should not happen
         }
+        if ( stored )
+            deflateLevel( level );
+        zin += l;
+        zout += bytes - before;
+        ztime += ( clock() - started ) * (int64)1000000 / CLOCKS_PER_SEC;
         break;
 
     case Decompressing:
@@ -241,7 +292,7 @@ void Buffer::remove( uint n )
     if ( bytes == 0 ) {
         firstused = firstfree = 0;
         vecs.clear();
-        if ( v && ( v->len > 100 && v->len < 20000 ) )
+        if ( v && !v->shared && v->len > 100 && v->len < 20000 )
             vecs.append( v );
         return;
     }
@@ -296,6 +347,10 @@ char Buffer::at( uint i ) const
 /*! Returns a string containing the first \a num bytes in the buffer. If
     the buffer contains fewer than \a num bytes, they are all returned.
     This function does not remove() the returned data.
+
+    If the bytes are all in the same internal vector, the string
+    shares that vector's memory instead of copying it, and the Buffer
+    never reuses the vector afterwards.
 */
 
 EString Buffer::string( uint num ) const
@@ -303,11 +358,10 @@ EString Buffer::string( uint num ) const
     EString result;
     uint n = size();
 
-    if ( n == 0 )
-        return result;
     if ( num < n )
         n = num;
-    result.reserve( n );
+    if ( n == 0 )
+        return result;
 
     List< Vector >::Iterator it( vecs );
     Vector *v = it;
@@ -319,9 +373,12 @@ EString Buffer::string( uint num ) const
 
     uint copied = max - firstused;
 
-    if ( copied > n )
-        copied = n;
+    if ( copied >= n ) {
+        v->shared = true;
+        return EString::shared( v->base + firstused, n );
+    }
 
+    result.reserve( n );
     result.append( v->base + firstused, copied );
 
     while ( copied < n ) {
@@ -353,8 +410,24 @@ EString * Buffer::removeLine( uint s )
     if ( s == 0 || s > size() )
         s = size();
 
-    while ( i < s && (*this)[i] != '\012' )
-        i++;
+    // look for the LF using memchr() on each vector in turn
+    uint o = firstused;
+    List< Vector >::Iterator it( vecs );
+    while ( it && i < s ) {
+        Vector * v = it;
+        ++it;
+        uint max = it ? v->len : firstfree;
+        n = max - o;
+        if ( n > s - i )
+            n = s - i;
+        const char * p = (const char *)memchr( v->base + o, '\012', n );
+        if ( p ) {
+            i += p - ( v->base + o );
+            break;
+        }
+        i += n;
+        o = 0;
+    }
 
     if ( i == s )
         return 0;
@@ -381,27 +454,55 @@ static void deallocwrapper( void *, void * x ) {
 
 
 /*! Instructs this Buffer to compress any data added if \a c is
-    Compressing, and to decompress if \a c is Decompressing.
+    Compressing, and to decompress if \a c is Decompressing. \a l is
+    the zlib compression level, from 1 (fastest) to 9 (smallest), and
+    is only used when compressing.
 
     \a c should never be None; that's the initial state, and it's
     impossible to get back to the initial state.
 */
 
-void Buffer::setCompression( Compression c )
+void Buffer::setCompression( Compression c, uint l )
 {
     zs = (z_stream *)Allocator::alloc( sizeof( z_stream ) );
     zs->zalloc = &allocwrapper;
     zs->zfree = &deallocwrapper;
     zs->opaque = 0;
+    if ( l < 1 || l > 9 )
+        l = 9;
+    level = l;
     if ( c == Compressing )
-        ::deflateInit2( zs, 9, Z_DEFLATED,
-                        -15, 9, Z_DEFAULT_STRATEGY );
+        ::deflateInit2( zs, level, Z_DEFLATED,
+                        -15, level > 6 ? 9 : 8, Z_DEFAULT_STRATEGY );
     else if ( c == Decompressing )
         ::inflateInit2( zs, -15 );
     filter = c;
 }
 
 
+/*! Switches the compressor to level \a l, first flushing whatever
+    zlib has buffered so that the change can take effect at once.
+*/
+
+void Buffer::deflateLevel( uint l )
+{
+    int r = Z_OK;
+    zs->avail_in = 0;
+    do {
+        zs->next_out = (Bytef*)buffer;
+        zs->avail_out = bufsiz;
+        r = ::deflate( zs, Z_SYNC_FLUSH );
+        if ( zs->avail_out < bufsiz )
+            append2( buffer, bufsiz - zs->avail_out );
+    } while ( r == Z_OK && zs->avail_out == 0 );
+    zs->next_out = (Bytef*)buffer;
+    zs->avail_out = bufsiz;
+    ::deflateParams( zs, l, Z_DEFAULT_STRATEGY );
+    if ( zs->avail_out < bufsiz )
+        append2( buffer, bufsiz - zs->avail_out );
+}
+
+
 /*! Returns Compressing, Decompressing or None depending on what's
     done to data added to the Buff. The initial value is None.
 */
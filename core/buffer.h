@@ -17,9 +17,13 @@ public:
     Buffer();
 
     enum Compression{ None, Compressing, Decompressing };
-    void setCompression( Compression );
+    void setCompression( Compression, uint = 9 );
     Compression compression() const;
 
+    int64 uncompressedBytes() const { return zin; }
+    int64 compressedBytes() const { return zout; }
+    int64 compressionTime() const { return ztime; }
+
     void append( const EString & );
     void append( const char *, uint );
 
@@ -49,21 +53,25 @@ private:
 private:
     void append( const char *, uint, bool );
     void append2( const char *, uint );
+    void deflateLevel( uint );
 
     struct Vector
         : public Garbage
     {
-        Vector() : base( 0 ), len( 0 ) {
+        Vector() : base( 0 ), len( 0 ), shared( false ) {
             setFirstNonPointer( &len );
         }
         char *base;
         // no pointers after this line
         uint len;
+        bool shared;
     };
 
     List< Vector > vecs;
     Compression filter;
     struct z_stream_s * zs;
+    uint level;
+    int64 zin, zout, ztime;
     uint firstused, firstfree;
     uint bytes;
 };
@@ -164,7 +164,13 @@ static struct {
     { "smarthost-port", Configuration::SmartHostPort, 25 },
     { "statistics-port", Configuration::StatisticsPort, 17220 },
     { "ldap-server-port", Configuration::LdapServerPort, 390 },
-    { "memory-limit", Configuration::MemoryLimit, 64 }
+    { "memory-limit", Configuration::MemoryLimit, 64 },
+    { "smarthost-connections", Configuration::SmartHostConnections, 4 },
+    { "db-reserved-handles", Configuration::DbReservedHandles, 1 },
+    { "db-replica-port", Configuration::DbReplicaPort, 5432 },
+    { "db-replica-handles", Configuration::DbReplicaHandles, 2 },
+    { "login-failure-limit", Configuration::LoginFailureLimit, 10 },
+    { "blob-threshold", Configuration::BlobThreshold, 262144 }
 };
 
 
@@ -211,7 +217,9 @@ static struct {
     { "smarthost-address", Configuration::SmartHostAddress, "127.0.0.1" },
     { "address-separator", Configuration::AddressSeparator, "" },
     { "statistics-address", Configuration::StatisticsAddress, "127.0.0.1" },
-    { "ldap-server-address", Configuration::LdapServerAddress, "127.0.0.1" }
+    { "ldap-server-address", Configuration::LdapServerAddress, "127.0.0.1" },
+    { "db-replica-address", Configuration::DbReplicaAddress, "" },
+    { "blob-store", Configuration::BlobStore, "" }
 };
 
 
@@ -243,7 +251,9 @@ static struct {
     { "use-statistics", Configuration::UseStatistics, false },
     { "soft-bounce", Configuration::SoftBounce, true },
     { "check-sender-addresses", Configuration::CheckSenderAddresses, false },
-    { "auto-flag-views", Configuration::AutoFlagViews, false }
+    { "auto-flag-views", Configuration::AutoFlagViews, false },
+    { "blob-compression", Configuration::BlobCompression, false },
+    { "compress-bodyparts", Configuration::CompressBodyparts, true }
 };
 
 
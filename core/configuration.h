@@ -57,6 +57,12 @@ public:
         StatisticsPort,
         LdapServerPort,
         MemoryLimit,
+        SmartHostConnections,
+        DbReservedHandles,
+        DbReplicaPort,
+        DbReplicaHandles,
+        LoginFailureLimit,
+        BlobThreshold,
         // additional scalars go ABOVE THIS LINE
         NumScalars
     };
@@ -102,6 +108,8 @@ public:
         AddressSeparator,
         StatisticsAddress,
         LdapServerAddress,
+        DbReplicaAddress,
+        BlobStore,
         // additional texts go ABOVE THIS LINE
         NumTexts
     };
@@ -134,6 +142,8 @@ public:
         SoftBounce,
         CheckSenderAddresses,
         AutoFlagViews,
+        BlobCompression,
+        CompressBodyparts,
         // additional toggles go ABOVE THIS LINE
         NumToggles
     };
@@ -104,6 +104,28 @@ EString::EString( const EString &s )
 }
 
 
+/*! Returns a read-only EString containing the \a n bytes at \a s,
+    without copying them.
+
+    \a s must point into memory obtained from Allocator::alloc(), so
+    that the returned string keeps that memory alive, and the caller
+    must never modify those \a n bytes afterwards. Like mid(), this
+    is copy-on-write: the string copies the data the first time
+    someone modifies it.
+*/
+
+EString EString::shared( const char * s, uint n )
+{
+    EString result;
+    if ( !s || !n )
+        return result;
+    result.d = new EStringData;
+    result.d->str = (char*)s;
+    result.d->len = n;
+    return result;
+}
+
+
 /*! \fn void EString::detach()
 
     Ensures that the string is modifiable. All EString functions call
@@ -304,10 +326,11 @@ EString EString::headerCased() const
 
 int EString::find( char c, int i ) const
 {
-    while ( i < (int)length() && at( i ) != c )
-        i++;
-    if ( i < (int)length() )
-        return i;
+    if ( i < 0 || i >= (int)length() )
+        return -1;
+    const char * p = (const char *)memchr( d->str + i, c, length() - i );
+    if ( p )
+        return p - (const char *)d->str;
     return -1;
 }
 
@@ -334,6 +357,41 @@ int EString::find( const EString & s, int i ) const
 }
 
 
+/*! Returns the position of the first CR or LF on or after \a i in
+    this string, or -1 if there is none.
+
+    This looks at eight bytes at a time, using the old trick for
+    finding a zero byte in a word, so it's several times faster than
+    looking at each byte in turn.
+*/
+
+int EString::findLineBreak( int i ) const
+{
+    if ( i < 0 )
+        return -1;
+    uint l = length();
+    uint j = i;
+    const char * s = data();
+    const unsigned long long ones = 0x0101010101010101ULL;
+    const unsigned long long highs = 0x8080808080808080ULL;
+    while ( j + 8 <= l ) {
+        unsigned long long w;
+        memcpy( &w, s + j, 8 );
+        unsigned long long cr = w ^ ( ones * 13 );
+        unsigned long long lf = w ^ ( ones * 10 );
+        if ( ( ( cr - ones ) & ~cr & highs ) ||
+             ( ( lf - ones ) & ~lf & highs ) )
+            break;
+        j += 8;
+    }
+    while ( j < l && s[j] != 13 && s[j] != 10 )
+        j++;
+    if ( j < l )
+        return j;
+    return -1;
+}
+
+
 /*! Returns section \a n of this string, where a section is defined as
     a run of sequences separated by \a s. If \a s is the empty string
     or \a n is 0, section() returns this entire string. If this string
@@ -542,6 +600,9 @@ void EString::setLength( uint l )
     in which case the rest of the string is returned.
 
     If \a start is too large, an empty string is returned.
+
+    The result shares this string's data rather than copying it;
+    whichever string is modified first makes its own copy then.
 */
 
 EString EString::mid( uint start, uint num ) const
@@ -556,6 +617,10 @@ EString EString::mid( uint start, uint num ) const
         return result;
 
     d->max = 0;
+    if ( !start && num == d->len ) {
+        result.d = d;
+        return result;
+    }
     result.d = new EStringData;
     result.d->str = d->str + start;
     result.d->len = num;
@@ -1796,12 +1861,14 @@ EString EString::crlf() const
         copy = false;
     uint i = 0;
     while ( copy && i < d->len ) {
-        if ( d->str[i] == 13 && i < d->len && d->str[i+1] == 10 )
+        int n = findLineBreak( i );
+        if ( n < 0 )
+            n = d->len;
+        i = n;
+        if ( i < d->len && d->str[i] == 13 && d->str[i+1] == 10 )
             i += 2;
-        else if ( d->str[i] == 13 || d->str[i] == 10 )
+        else if ( i < d->len )
             copy = false;
-        else
-            i++;
     }
     if ( copy )
         return *this;
@@ -1814,25 +1881,27 @@ EString EString::crlf() const
     if ( d )
         len = d->len;
     while ( i < len ) {
-        lf = false;
-        char c = d->str[i++];
-
-        if ( c == 10 ) {
-            lf = true;
+        // copy the rest of the line in one go
+        int n = findLineBreak( i );
+        if ( n < 0 )
+            n = len;
+        if ( (uint)n > i ) {
+            r.append( d->str + i, n - i );
+            lf = false;
+            i = n;
         }
-        else if ( c == 13 ) {
+        if ( i < len ) {
+            char c = d->str[i++];
+            if ( c == 13 ) {
+                if ( i < d->len && d->str[i] == 10 )
+                    i++;
+                else if ( i < d->len-1 &&
+                          d->str[i] == 13 && d->str[i+1] == 10 )
+                    i += 2;
+            }
+            r.append( "\r\n" );
             lf = true;
-            if ( i < d->len && d->str[i] == 10 )
-                i++;
-            else if ( i < d->len-1 &&
-                      d->str[i] == 13 && d->str[i+1] == 10 )
-                i += 2;
         }
-
-        if ( lf )
-            r.append( "\r\n" );
-        else
-            r.append( c );
     }
     if ( !lf )
         r.append( "\r\n" );
@@ -37,6 +37,8 @@ public:
     EString( const EString & );
     ~EString();
 
+    static EString shared( const char *, uint );
+
     EString & operator=( const EString & );
     EString & operator=( const char * );
     EString & operator+=( const EString & str ) { append( str ); return *this; }
@@ -87,6 +89,7 @@ public:
 
     int find( char, int=0 ) const;
     int find( const EString &, int=0 ) const;
+    int findLineBreak( int=0 ) const;
     bool contains( const EString & ) const;
     bool contains( const char ) const;
     bool containsWord( const EString & ) const;
@@ -176,3 +176,14 @@ void Log::setLogLevel( Severity s )
 {
     logLevel = s;
 }
+
+
+/*! Returns true if messages of severity \a s are logged, and false if
+    log() discards them. Code which builds expensive log messages on
+    busy paths can check this first and build nothing.
+*/
+
+bool Log::enabled( Severity s )
+{
+    return s >= logLevel;
+}
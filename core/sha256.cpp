@@ -0,0 +1,226 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "sha256.h"
+
+#include "estring.h"
+
+
+static const uint32 k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+static inline uint32 rotr( uint32 x, uint n )
+{
+    return ( x >> n ) | ( x << ( 32 - n ) );
+}
+
+
+/*! \class SHA256 sha256.h
+    Implements the SHA-256 message-digest algorithm (FIPS 180-2).
+
+    The interface is the same as that of MD5. SHA-256 is used where a
+    hash must identify content reliably, e.g. to name the files in the
+    BlobStore.
+*/
+
+/*! Creates and initialises an empty SHA256 object. */
+
+SHA256::SHA256()
+{
+    init();
+}
+
+
+/*! Initialises a SHA256 context for use. */
+
+void SHA256::init()
+{
+    state[0] = 0x6a09e667;
+    state[1] = 0xbb67ae85;
+    state[2] = 0x3c6ef372;
+    state[3] = 0xa54ff53a;
+    state[4] = 0x510e527f;
+    state[5] = 0x9b05688c;
+    state[6] = 0x1f83d9ab;
+    state[7] = 0x5be0cd19;
+
+    length[0] = 0;
+    length[1] = 0;
+    used = 0;
+
+    finalised = false;
+}
+
+
+/*! Updates the SHA256 context to reflect the concatenation of \a len
+    bytes from \a str.
+*/
+
+void SHA256::add( const char * str, uint len )
+{
+    // As with MD5, hash() destroys the accumulated input, so adding
+    // more data afterwards starts a new hash.
+    if ( finalised )
+        init();
+
+    uint32 t = length[0];
+    length[0] = t + ( (uint32)len << 3 );
+    if ( length[0] < t )
+        length[1]++;
+    length[1] += len >> 29;
+
+    while ( len ) {
+        uint n = 64 - used;
+        if ( n > len )
+            n = len;
+        uint i = 0;
+        while ( i < n ) {
+            in[used + i] = (unsigned char)str[i];
+            i++;
+        }
+        used += n;
+        str += n;
+        len -= n;
+        if ( used == 64 ) {
+            transform();
+            used = 0;
+        }
+    }
+}
+
+
+/*! This version of add() adds the contents of \a s. */
+
+void SHA256::add( const EString & s )
+{
+    add( s.data(), s.length() );
+}
+
+
+/*! Returns the SHA-256 hash of the data added so far, as a string of
+    32 bytes. Use EString::hex() to get the usual hexadecimal form.
+*/
+
+EString SHA256::hash()
+{
+    uint32 hi = length[1];
+    uint32 lo = length[0];
+
+    in[used++] = 0x80;
+    if ( used > 56 ) {
+        while ( used < 64 )
+            in[used++] = 0;
+        transform();
+        used = 0;
+    }
+    while ( used < 56 )
+        in[used++] = 0;
+    uint i = 0;
+    while ( i < 4 ) {
+        in[56 + i] = (unsigned char)( hi >> ( 24 - 8 * i ) );
+        in[60 + i] = (unsigned char)( lo >> ( 24 - 8 * i ) );
+        i++;
+    }
+    transform();
+
+    EString r;
+    r.reserve( 32 );
+    i = 0;
+    while ( i < 8 ) {
+        r.append( (char)( state[i] >> 24 ) );
+        r.append( (char)( state[i] >> 16 ) );
+        r.append( (char)( state[i] >> 8 ) );
+        r.append( (char)( state[i] ) );
+        i++;
+    }
+
+    finalised = true;
+    return r;
+}
+
+
+/*! Returns the SHA-256 hash of \a s. */
+
+EString SHA256::hash( const EString & s )
+{
+    SHA256 h;
+    h.add( s );
+    return h.hash();
+}
+
+
+/*! Processes the 64 bytes in the input buffer and updates the state
+    accordingly.
+*/
+
+void SHA256::transform()
+{
+    uint32 w[64];
+    uint i = 0;
+    while ( i < 16 ) {
+        w[i] = ( (uint32)in[4*i] << 24 ) | ( (uint32)in[4*i+1] << 16 ) |
+               ( (uint32)in[4*i+2] << 8 ) | (uint32)in[4*i+3];
+        i++;
+    }
+    while ( i < 64 ) {
+        uint32 s0 = rotr( w[i-15], 7 ) ^ rotr( w[i-15], 18 ) ^
+                    ( w[i-15] >> 3 );
+        uint32 s1 = rotr( w[i-2], 17 ) ^ rotr( w[i-2], 19 ) ^
+                    ( w[i-2] >> 10 );
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+        i++;
+    }
+
+    uint32 a = state[0];
+    uint32 b = state[1];
+    uint32 c = state[2];
+    uint32 d = state[3];
+    uint32 e = state[4];
+    uint32 f = state[5];
+    uint32 g = state[6];
+    uint32 h = state[7];
+
+    i = 0;
+    while ( i < 64 ) {
+        uint32 s1 = rotr( e, 6 ) ^ rotr( e, 11 ) ^ rotr( e, 25 );
+        uint32 ch = ( e & f ) ^ ( ~e & g );
+        uint32 t1 = h + s1 + ch + k[i] + w[i];
+        uint32 s0 = rotr( a, 2 ) ^ rotr( a, 13 ) ^ rotr( a, 22 );
+        uint32 maj = ( a & b ) ^ ( a & c ) ^ ( b & c );
+        uint32 t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+        i++;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
@@ -0,0 +1,36 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include "global.h"
+
+
+class EString;
+
+
+class SHA256
+    : public Garbage
+{
+public:
+    SHA256();
+
+    void add( const char *, uint );
+    void add( const EString & );
+
+    EString hash();
+    static EString hash( const EString & );
+
+private:
+    bool finalised;
+    uint32 length[2];
+    uint32 state[8];
+    uint used;
+    unsigned char in[64];
+
+    void init();
+    void transform();
+};
+
+
+#endif
@@ -3,7 +3,9 @@
 #include "database.h"
 
 #include "list.h"
+#include "map.h"
 #include "estring.h"
+#include "estringlist.h"
 #include "allocator.h"
 #include "configuration.h"
 #include "eventloop.h"
@@ -22,20 +24,73 @@
 
 
 static uint backendNumber;
-List< Query > *Database::queries;
 static GraphableNumber * queryQueueLength = 0;
 static GraphableNumber * busyDbConnections = 0;
 static GraphableNumber * totalDbConnections = 0;
 static List< Database > *handles;
 static time_t lastExecuted;
 static time_t lastCreated;
+static time_t lastReplicaCreated;
 static Database::User loginAs;
 static EString * username;
 static EString * password;
 static List<EventHandler> * whenIdle;
 
 
-static void newHandle()
+// A query waiting to be sent, and the connection it's sent for.
+class SubmittedQuery
+    : public Garbage
+{
+public:
+    SubmittedQuery( Query * query, Log * l )
+        : Garbage(), q( query ), source( l ) {}
+
+    Query * q;
+    Log * source;
+};
+
+
+// One queue for each priority class, and the number of queries in
+// all three.
+static List<SubmittedQuery> * queues[3];
+static uint queued;
+
+
+/*! Returns the log of the connection (or other top-level object) on
+    whose behalf \a q is run. The global Scope's log is the root, each
+    Listener's is a child of that, and each Connection's is a
+    grandchild; commands and their queries are further down.
+*/
+
+static Log * source( Query * q )
+{
+    Log * k[3] = { 0, 0, 0 };
+    Log * l = q->log();
+    while ( l ) {
+        k[2] = k[1];
+        k[1] = k[0];
+        k[0] = l;
+        l = l->parent();
+    }
+    if ( k[2] )
+        return k[2];
+    if ( k[1] )
+        return k[1];
+    return k[0];
+}
+
+
+/*! Adds \a q to the queue for its priority class. */
+
+static void addToQueue( Query * q )
+{
+    q->setState( Query::Submitted );
+    queues[q->priority()]->append( new SubmittedQuery( q, source( q ) ) );
+    queued++;
+}
+
+
+static void newHandle( uint replica = 0 )
 {
     Scope x;
     if ( handles && !handles->isEmpty() ) {
@@ -45,7 +100,7 @@ static void newHandle()
         if ( l )
             x.setLog( l );
     }
-    (void)new Postgres;
+    (void)new Postgres( replica );
 }
 
 
@@ -58,16 +113,29 @@ static void newHandle()
     This is the abstract base class for Postgres (and any other database
     interface classes we implement). It's responsible for validating the
     database configuration, maintaining a pool of database handles, and
-    accepting queries into a common queue via submit().
+    accepting queries into common queues via submit().
+
+    Some handles may be connected to read-only replicas of the
+    database (see db-replica-address). Such handles only process
+    read-only queries outside transactions, and are offered work
+    before the handles to the primary server.
 */
 
-Database::Database()
-    : Connection()
+/*! Constructs a database handle. If \a replica is nonzero, the
+    handle is connected to that replica (counting from 1) rather than
+    to the primary server.
+*/
+
+Database::Database( uint replica )
+    : Connection(), rep( replica ), probe( 0 )
 {
     number = ++::backendNumber;
     setType( Connection::DatabaseClient );
     setState( Database::Connecting );
-    lastCreated = time( 0 );
+    if ( replica )
+        lastReplicaCreated = time( 0 );
+    else
+        lastCreated = time( 0 );
 }
 
 
@@ -84,9 +152,13 @@ Database::Database()
 void Database::setup( uint desired, const EString & user,
                       const EString & pass )
 {
-    if ( !queries ) {
-        queries = new List< Query >;
-        Allocator::addEternal( queries, "list of queries" );
+    if ( !queues[0] ) {
+        uint p = 0;
+        while ( p < 3 ) {
+            queues[p] = new List<SubmittedQuery>;
+            Allocator::addEternal( queues[p], "queue of queries" );
+            p++;
+        }
     }
 
     if ( !handles ) {
@@ -114,6 +186,19 @@ void Database::setup( uint desired, const EString & user,
     }
 
     addInitialHandles( desired );
+
+    if ( ::loginAs != DbUser )
+        return;
+
+    uint r = replicas();
+    while ( r ) {
+        uint n = Configuration::scalar( Configuration::DbReplicaHandles );
+        while ( n ) {
+            newHandle( r );
+            n--;
+        }
+        r--;
+    }
 }
 
 
@@ -171,19 +256,18 @@ void Database::setup( uint desired, Database::User login )
 }
 
 
-/*! Adds \a q to the queue of submitted queries and sets its state to
+/*! Adds \a q to the queues of submitted queries and sets its state to
     Query::Submitted. The first available handle will process it.
 */
 
 void Database::submit( Query *q )
 {
-    queries->append( q );
-    q->setState( Query::Submitted );
+    addToQueue( q );
     runQueue();
 }
 
 
-/*! Adds the queries in the list \a q to the queue of submitted queries,
+/*! Adds the queries in the list \a q to the queues of submitted queries,
     and sets their state to Query::Submitted. The first available handle
     will process them (but it's not guaranteed that the same handle will
     process them all. Use a Transaction if you depend on ordering).
@@ -193,8 +277,7 @@ void Database::submit( List< Query > *q )
 {
     List< Query >::Iterator it( q );
     while ( it ) {
-        it->setState( Query::Submitted );
-        queries->append( it );
+        addToQueue( it );
         ++it;
     }
     runQueue();
@@ -235,42 +318,54 @@ void Database::runQueue()
     if ( !busyDbConnections )
         busyDbConnections = new GraphableNumber( "active-db-connections" );
 
-    // First, we give each idle handle a Query to process
+    // First, we give each idle handle a Query to process. Replicas
+    // go first, so the primary gets what they cannot or will not do.
 
-    Query * first = queries->firstElement();
+    uint before = queued;
 
-    List< Database >::Iterator it( handles );
-    while ( it ) {
-        State st = it->state();
-
-        if ( st != Connecting && // connecting isn't working
-             st != Broken && // broken isn't working
-             ( !it->usable() || // processing a query is working
-               st == InTransaction || // occupied by a transaction is, too
-               st == FailedTransaction ) )
-            busy++;
-
-        if ( st == Idle && it->usable() ) {
-            it->processQueue();
-            if ( queries->isEmpty() ) {
-                queryQueueLength->setValue( 0 );
-                busyDbConnections->setValue( busy );
-                return;
+    uint count[2] = { 0, 0 }; // replica and primary handles
+    uint pass = 0;
+    while ( pass < 2 ) {
+        List< Database >::Iterator it( handles );
+        while ( it ) {
+            if ( ( pass == 0 ) != ( it->rep != 0 ) ) {
+                ++it;
+                continue;
             }
-        }
-        else if ( st == Connecting ) {
-            connecting++;
-        }
 
-        ++it;
+            State st = it->state();
+            count[pass]++;
+
+            if ( st != Connecting && // connecting isn't working
+                 st != Broken && // broken isn't working
+                 ( !it->usable() || // processing a query is working
+                   st == InTransaction || // occupied by a transaction is
+                   st == FailedTransaction ) ) // too
+                busy++;
+
+            if ( st == Idle && it->usable() ) {
+                it->processQueue();
+                if ( !queued ) {
+                    queryQueueLength->setValue( 0 );
+                    busyDbConnections->setValue( busy );
+                    return;
+                }
+            }
+            else if ( st == Connecting ) {
+                connecting++;
+            }
+
+            ++it;
+        }
+        pass++;
     }
 
-    queryQueueLength->setValue( queries->count() );
+    queryQueueLength->setValue( queued );
     busyDbConnections->setValue( busy );
 
     // If there's nothing to do, or we did get something done, then we
     // don't even consider opening a new database connection.
-    if ( queries->isEmpty() || first != queries->firstElement() )
+    if ( !queued || queued < before )
         return;
 
     // Even if we want to, we cannot create unix-domain handles when
@@ -284,14 +379,38 @@ void Database::runQueue()
     if ( EventLoop::global()->inShutdown() )
         return;
 
-    // We create at most one new handle per interval.
+    // We create at most one new handle to the primary per interval,
+    // and at most one to the replicas. The two are timed separately,
+    // so that an unreachable replica doesn't keep the primary's pool
+    // from growing.
     int interval = Configuration::scalar( Configuration::DbHandleInterval );
-    if ( time( 0 ) - lastCreated < interval )
-        return;
+    time_t now = time( 0 );
+
+    // Replicas that have gone away are replaced.
+    uint wanted = Configuration::scalar( Configuration::DbReplicaHandles );
+    if ( ::loginAs == DbUser &&
+         count[0] < replicas() * wanted &&
+         now - lastReplicaCreated >= interval ) {
+        uint r = replicas();
+        while ( r ) {
+            uint n = 0;
+            List< Database >::Iterator it( handles );
+            while ( it ) {
+                if ( it->rep == r )
+                    n++;
+                ++it;
+            }
+            if ( n < wanted ) {
+                newHandle( r );
+                break;
+            }
+            r--;
+        }
+    }
 
     // If we don't have too many, we can create another handle!
     uint max = Configuration::scalar( Configuration::DbMaxHandles );
-    if ( handles->count() < max )
+    if ( count[1] < max && now - lastCreated >= interval )
         newHandle();
 }
 
@@ -392,6 +511,36 @@ uint Database::port()
 }
 
 
+/*! Returns the number of replicas listed in db-replica-address. */
+
+uint Database::replicas()
+{
+    EString s = Configuration::text( Configuration::DbReplicaAddress );
+    s = s.simplified();
+    if ( s.isEmpty() )
+        return 0;
+    return EStringList::split( ' ', s )->count();
+}
+
+
+/*! Returns the address of replica \a n, counting from 1, or an empty
+    string if there is no such replica.
+*/
+
+EString Database::replicaAddress( uint n )
+{
+    EString s = Configuration::text( Configuration::DbReplicaAddress );
+    EStringList::Iterator i( EStringList::split( ' ', s.simplified() ) );
+    while ( i && n > 1 ) {
+        ++i;
+        n--;
+    }
+    if ( !i || !n )
+        return "";
+    return *i;
+}
+
+
 /*! Returns the configured database name (db-name). */
 
 EString Database::name()
@@ -420,7 +569,7 @@ EString Database::password()
 
 
 /*! Returns the number of database handles currently connected to the
-    database.
+    primary database server. Handles to replicas aren't counted.
 */
 
 uint Database::numHandles()
@@ -430,7 +579,7 @@ uint Database::numHandles()
     uint n = 0;
     List<Database>::Iterator it( ::handles );
     while ( it ) {
-        if ( it->state() != Connecting )
+        if ( it->state() != Connecting && !it->rep )
             n++;
         ++it;
     }
@@ -462,6 +611,17 @@ bool Database::usable() const
 }
 
 
+/*! Returns the number of the replica to which this handle is
+    connected, counting from 1, or 0 if it's connected to the primary
+    database server.
+*/
+
+uint Database::replica() const
+{
+    return rep;
+}
+
+
 /*! Returns an nonzero positive integer which is unique to this
     database handler.
 */
@@ -514,7 +674,7 @@ bool Database::idle()
         ++it;
     }
 
-    if ( queries && !queries->isEmpty() )
+    if ( queued )
         return false;
 
     return true;
@@ -528,7 +688,7 @@ bool Database::idle()
 
 void Database::reactToIdleness()
 {
-    if ( !queries->isEmpty() )
+    if ( queued )
         return;
 
     if ( !::whenIdle )
@@ -704,29 +864,202 @@ void Database::cancelQuery( Query * q )
 
 uint Database::currentRevision()
 {
-    return 95;
+    return 101;
 }
 
 
+class ReplicaModSeq
+    : public Garbage
+{
+public:
+    ReplicaModSeq(): modseq( 0 ), checked( 0 ) {}
+
+    int64 modseq;
+    uint checked;
+};
+
+
+/*! \class ReplicaProbe database.cpp
+    Keeps track of how far a replica has caught up.
+
+    Each replica handle has a ReplicaProbe, which records the highest
+    nextmodseq that handle has seen for each mailbox, and asks when a
+    query needs a higher one (see Query::setMinimumModSeq()). Each
+    mailbox is checked at most once per second; until the replica
+    catches up, such queries are left for the primary.
+*/
+
+class ReplicaProbe
+    : public EventHandler
+{
+public:
+    ReplicaProbe(): EventHandler(), q( 0 ), mailbox( 0 ) {}
+
+    bool fresh( Query * query ) {
+        if ( !query->minimumModSeq() )
+            return true;
+        ReplicaModSeq * s = seen.find( query->minimumModSeqMailbox() );
+        return s && s->modseq >= query->minimumModSeq();
+    }
+
+    bool checkable( Query * query ) {
+        if ( q )
+            return false;
+        ReplicaModSeq * s = seen.find( query->minimumModSeqMailbox() );
+        return !s || s->checked < (uint)time( 0 );
+    }
+
+    Query * check( uint m ) {
+        ReplicaModSeq * s = seen.find( m );
+        if ( !s ) {
+            s = new ReplicaModSeq;
+            seen.insert( m, s );
+        }
+        s->checked = (uint)time( 0 );
+        mailbox = m;
+        q = new Query( "select nextmodseq from mailboxes where id=$1",
+                       this );
+        q->bind( 1, m );
+        q->setState( Query::Submitted );
+        return q;
+    }
+
+    void execute() {
+        if ( !q || !q->done() )
+            return;
+        Row * r = q->nextRow();
+        if ( r ) {
+            ReplicaModSeq * s = seen.find( mailbox );
+            if ( s )
+                s->modseq = r->getBigint( "nextmodseq" );
+        }
+        q = 0;
+    }
+
+    Map<ReplicaModSeq> seen;
+    Query * q;
+    uint mailbox;
+};
+
+
+// Which priority class gets each of ten consecutive turns: seven for
+// Interactive, two for Background and one for Bulk.
+static const uint turns[10] = { 0, 0, 0, 1, 0, 0, 2, 0, 0, 1 };
+static uint turn;
+static Log * lastSource[3];
+
+
 /*! Removes a submitted transaction from the global list and returns a
     list contains just that transaction.
 
     If \a transactionOK is true, the list is permitted to start a
     Transaction. If not, only standalone queries are considered.
 
+    Interactive queries get seven turns out of ten, Background two and
+    Bulk one; when the class whose turn it is has nothing to do, the
+    most important class that has something gets the turn. Background
+    and Bulk queries are held back if starting them would leave fewer
+    than db-reserved-handles idle handles. Within each class, the
+    oldest query from a different connection than the last one served
+    is preferred, so that one busy client cannot starve the others.
+
+    Each class has its own queue, and submit() notes each query's
+    connection, so this function looks at no more than 64 queries in
+    each class however long the queues get.
+
+    A replica handle only considers read-only queries outside
+    transactions, and skips those that need data it may not have seen
+    yet. If there's nothing else to do, it uses the opportunity to
+    check how far it has caught up.
+
     Returns an empty list if no suitable queries can be found.
 */
 
 List< Query > * Database::firstSubmittedQuery( bool transactionOK )
 {
-    List<Query>::Iterator i( queries );
-    if ( !transactionOK )
-        while ( i && i->transaction() )
-            ++i;
+    if ( rep && !probe )
+        probe = new ReplicaProbe;
+
+    uint reserved =
+        Configuration::scalar( Configuration::DbReservedHandles );
+    uint n = 0;
+    uint idle = 0;
+    List<Database>::Iterator h( handles );
+    while ( h ) {
+        if ( ( h->rep != 0 ) != ( rep != 0 ) ) {
+            // the primary and the replicas are counted separately
+        }
+        else {
+            if ( h->state() != Connecting && h->state() != Broken )
+                n++;
+            if ( h->state() == Idle && h->usable() )
+                idle++;
+        }
+        ++h;
+    }
+    if ( n && reserved >= n )
+        reserved = n - 1;
+    bool busy = idle <= reserved;
+
+    // the class whose turn it is goes first, then the others in
+    // order of importance.
+    uint order[4];
+    order[0] = turns[turn];
+    turn = ( turn + 1 ) % 10;
+    uint c = 0;
+    while ( c < 3 ) {
+        order[c + 1] = c;
+        c++;
+    }
+
     List<Query> * r = new List<Query>();
-    if ( i ) {
-        r->append( i );
-        queries->take( i );
+    uint stale = 0;
+    c = 0;
+    while ( c < 4 && r->isEmpty() ) {
+        uint p = order[c++];
+        if ( c > 1 && p == order[0] )
+            continue;
+        if ( p != Query::Interactive && busy )
+            continue;
+
+        List<SubmittedQuery>::Iterator oldest;
+        List<SubmittedQuery>::Iterator other;
+        List<SubmittedQuery>::Iterator i( queues[p] );
+        uint seen = 0;
+        while ( i && !other && seen < 64 ) {
+            Query * q = i->q;
+            bool ok = transactionOK || !q->transaction();
+            if ( ok && rep ) {
+                if ( !q->readOnly() || q->transaction() ) {
+                    ok = false;
+                }
+                else if ( !probe->fresh( q ) ) {
+                    if ( !stale && probe->checkable( q ) )
+                        stale = q->minimumModSeqMailbox();
+                    ok = false;
+                }
+            }
+            if ( ok ) {
+                if ( !oldest )
+                    oldest = i;
+                if ( i->source != lastSource[p] )
+                    other = i;
+            }
+            ++seen;
+            ++i;
+        }
+
+        if ( !other )
+            other = oldest;
+        if ( other ) {
+            lastSource[p] = other->source;
+            r->append( other->q );
+            queues[p]->take( other );
+            queued--;
+        }
     }
+
+    if ( r->isEmpty() && stale )
+        r->append( probe->check( stale ) );
     return r;
 }
@@ -14,7 +14,7 @@ class Database
     : public Connection
 {
 public:
-    Database();
+    Database( uint = 0 );
 
     enum User {
         Superuser, DbOwner, DbUser
@@ -40,6 +40,7 @@ public:
     static EString type();
 
     uint connectionNumber() const;
+    uint replica() const;
 
     static uint currentRevision();
 
@@ -54,8 +55,6 @@ public:
     static void cancelQuery( Query * );
 
 protected:
-    static List< Query > *queries;
-
     List< Query > * firstSubmittedQuery( bool transactionOK );
 
     void setState( State );
@@ -70,6 +69,8 @@ protected:
     static Endpoint server();
     static EString address();
     static uint port();
+    static uint replicas();
+    static EString replicaAddress( uint );
 
     static EString name();
     static EString user();
@@ -82,6 +83,8 @@ protected:
 private:
     State st;
     uint number;
+    uint rep;
+    class ReplicaProbe * probe;
 };
 
 
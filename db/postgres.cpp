@@ -133,27 +133,35 @@ public:
 
 /*! Creates a Postgres object, initiates a TCP connection to the server,
     registers with the main loop, and adds this Database to the list of
-    available handles.
+    available handles. If \a replica is nonzero, the connection goes to
+    that read-only replica instead of the primary server.
 */
 
-Postgres::Postgres()
-    : Database(), d( new PgData )
+Postgres::Postgres( uint replica )
+    : Database( replica ), d( new PgData )
 {
+    EString a = address();
+    uint port = Database::port();
+    if ( replica ) {
+        a = replicaAddress( replica );
+        port = Configuration::scalar( Configuration::DbReplicaPort );
+    }
+
     d->user = Database::user();
     struct passwd * p = getpwnam( d->user.cstr() );
     if ( p && getuid() != p->pw_uid ) {
         // Try to cooperate with ident authentication.
         uid_t e = geteuid();
         setreuid( 0, p->pw_uid );
-        connect( address(), port() );
+        connect( a, port );
         setreuid( 0, e );
     }
     else {
-        connect( address(), port() );
+        connect( a, port );
     }
 
     log( "Connecting to PostgreSQL server at " +
-         address() + ":" + fn( port() ) + " "
+         a + ":" + fn( port ) + " "
          "(backend " + fn( connectionNumber() ) + ", fd " + fn( fd() ) +
          ", user " + d->user + ")", Log::Debug );
 
@@ -183,7 +191,7 @@ void Postgres::processQueue()
            d->transaction->state() == Transaction::RolledBack ) )
         d->transaction = 0;
 
-    if ( !::listener && !d->transaction )
+    if ( !::listener && !d->transaction && !replica() )
         ::listener = this;
     if ( ::listener == this )
         sendListen();
@@ -231,7 +239,7 @@ void Postgres::processQuery( Query * q )
 {
     Scope x( q->log() );
     d->queries.append( q );
-    EString s( "Sent " );
+    EString s;
     if ( q->name() == "" ||
          !d->prepared.contains( q->name() ) )
     {
@@ -259,11 +267,9 @@ void Postgres::processQuery( Query * q )
     PgSync e;
     e.enqueue( writeBuffer() );
 
-    s.append( "execute for " );
-    s.append( q->description() );
-    s.append( " on backend " );
-    s.appendNumber( connectionNumber() );
-    ::log( s, Log::Debug );
+    if ( Log::enabled( Log::Debug ) )
+        ::log( "Sent " + s + "execute for " + q->description() +
+               " on backend " + fn( connectionNumber() ), Log::Debug );
     recordExecution();
 }
 
@@ -346,7 +352,7 @@ void Postgres::react( Event e )
                 log( "Transaction unexpectedly slow; continuing " );
         }
         else if ( d->queries.isEmpty() &&
-                  ::listener != this &&
+                  ::listener != this && !replica() &&
                   server().protocol() != Endpoint::Unix &&
                   handlesNeeded() < numHandles() ) {
             log( "Closing idle database backend " + fn( connectionNumber() ) +
@@ -889,6 +895,15 @@ void Postgres::serverMessage()
         if ( q->inputLines() )
             d->sendingCopy = false;
         d->queries.shift();
+        if ( replica() && !q->transaction() && !q->rows() &&
+             ( code == "40001" || code == "40P01" ) ) {
+            // a hot standby cancelled the query because of a
+            // conflict with recovery. the primary can answer it.
+            ::log( s + "; retrying on the primary", Log::Debug );
+            q->setReadOnly( false );
+            submit( q );
+            return;
+        }
         m = mapped( m );
         if ( !msg.detail().isEmpty() )
             s.append( " (" + msg.detail() + ")" );
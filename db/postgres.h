@@ -12,7 +12,7 @@ class Postgres
     : public Database
 {
 public:
-    Postgres();
+    Postgres( uint = 0 );
     ~Postgres();
 
     void processQueue();
@@ -5,6 +5,7 @@
 #include "log.h"
 #include "utf.h"
 #include "event.h"
+#include "graph.h"
 #include "scope.h"
 #include "estring.h"
 #include "ustring.h"
@@ -24,7 +25,9 @@ public:
         : state( Query::Inactive ), format( Query::Text ),
           values( new Query::InputLine ), inputLines( 0 ),
           transaction( 0 ), owner( 0 ), totalRows( 0 ),
-          canFail( false )
+          canFail( false ), priority( Query::Interactive ),
+          readOnly( false ), mailbox( 0 ), modseq( 0 ),
+          submitted( 0 ), executing( 0 )
     {}
 
     Query::State state;
@@ -45,6 +48,15 @@ public:
 
     bool canFail;
     bool canBeSlow;
+
+    Query::Priority priority;
+
+    bool readOnly;
+    uint mailbox;
+    int64 modseq;
+
+    int64 submitted;
+    int64 executing;
 };
 
 
@@ -140,10 +152,36 @@ Query::State Query::state() const
 /*! Sets the state of this object to \a s.
     The initial state of each Query is Inactive, and the Database changes
     it to indicate the query's progress.
+
+    The time spent waiting for a database handle and the time spent
+    executing are recorded using GraphableHistogram, the former by
+    priority() and the latter by name().
 */
 
 void Query::setState( State s )
 {
+    if ( s == Submitted ) {
+        d->submitted = GraphableHistogram::timestamp();
+    }
+    else if ( s == Executing ) {
+        static const char * priorities[] = {
+            "interactive", "background", "bulk"
+        };
+        d->executing = GraphableHistogram::timestamp();
+        if ( d->submitted )
+            GraphableHistogram::find( "db_queue_wait_seconds",
+                                      "class", priorities[d->priority] )
+                ->addSince( d->submitted );
+        d->submitted = 0;
+    }
+    else if ( ( s == Completed || s == Failed ) && d->executing ) {
+        EString n( d->name );
+        if ( n.isEmpty() )
+            n = "unnamed";
+        GraphableHistogram::find( "db_query_seconds", "query", n )
+            ->addSince( d->executing );
+        d->executing = 0;
+    }
     d->state = s;
 }
 
@@ -198,6 +236,94 @@ void Query::allowFailure()
 }
 
 
+/*! Records that this Query has priority \a p. The Database gives most
+    of its attention to Interactive queries (the default), some to
+    Background queries and a little to Bulk queries, and never lets
+    the last few idle handles be used for anything but Interactive
+    queries.
+
+    For a Transaction, only the priority of the BEGIN matters, so
+    Transaction::setPriority() should be used.
+*/
+
+void Query::setPriority( Priority p )
+{
+    d->priority = p;
+}
+
+
+/*! Returns the priority set by setPriority(), or Interactive if
+    setPriority() hasn't been called.
+*/
+
+Query::Priority Query::priority() const
+{
+    return d->priority;
+}
+
+
+/*! Records that this Query doesn't modify the database if \a r is
+    true, and that it may modify it if \a r is false. The default is
+    false.
+
+    A read-only Query outside a Transaction may be sent to one of the
+    db-replica-address servers rather than to the primary. Such a
+    server may lag behind the primary; setMinimumModSeq() can be used
+    to avoid seeing stale data. If a hot standby cancels the Query
+    before returning any rows, it is sent to the primary instead.
+*/
+
+void Query::setReadOnly( bool r )
+{
+    d->readOnly = r;
+}
+
+
+/*! Returns what setReadOnly() set, or false if setReadOnly() hasn't
+    been called.
+*/
+
+bool Query::readOnly() const
+{
+    return d->readOnly;
+}
+
+
+/*! Records that this Query may be sent to a replica only if that
+    replica has seen the mailbox with id \a mailbox reach a
+    nextmodseq of at least \a modseq. A Session typically passes its
+    own nextModSeq(), so that a client always sees its own changes.
+
+    This has no effect unless setReadOnly() is used too.
+*/
+
+void Query::setMinimumModSeq( uint mailbox, int64 modseq )
+{
+    d->mailbox = mailbox;
+    d->modseq = modseq;
+}
+
+
+/*! Returns the mailbox id set by setMinimumModSeq(), or 0 if there
+    is no such restriction.
+*/
+
+uint Query::minimumModSeqMailbox() const
+{
+    return d->mailbox;
+}
+
+
+/*! Returns the modseq set by setMinimumModSeq(), or 0 if there is no
+    such restriction.
+*/
+
+int64 Query::minimumModSeq() const
+{
+    return d->modseq;
+}
+
+
 /*! Returns a pointer to the Transaction that this Query is associated
     with, or 0 if this Query is self-contained.
 */
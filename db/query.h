@@ -39,6 +39,16 @@ public:
     bool canFail() const;
     void allowFailure();
 
+    enum Priority { Interactive, Background, Bulk };
+    void setPriority( Priority );
+    Priority priority() const;
+
+    void setReadOnly( bool );
+    bool readOnly() const;
+    void setMinimumModSeq( uint, int64 );
+    uint minimumModSeqMailbox() const;
+    int64 minimumModSeq() const;
+
     Transaction *transaction() const;
     void setTransaction( Transaction * );
 
@@ -619,6 +619,18 @@ bool Schema::singleStep()
         c = stepTo94(); break;
     case 94:
         c = stepTo95(); break;
+    case 95:
+        c = stepTo96(); break;
+    case 96:
+        c = stepTo97(); break;
+    case 97:
+        c = stepTo98(); break;
+    case 98:
+        c = stepTo99(); break;
+    case 99:
+        c = stepTo100(); break;
+    case 100:
+        c = stepTo101(); break;
     default:
         d->l->log( "Internal error. Reached impossible revision " +
                    fn( d->revision ) + ".", Log::Disaster );
@@ -4367,3 +4379,113 @@ bool Schema::stepTo95()
 
     return true;
 }
+
+
+/*! Notify aliases_updated whenever something Sieve::addRecipient()
+    looks at changes, so that servers can keep all aliases in RAM.
+*/
+
+bool Schema::stepTo96()
+{
+    describeStep( "Adding triggers to help caching aliases." );
+    d->t->enqueue( "create or replace function notify_aliases() "
+                   "returns trigger as $$ "
+                   "begin "
+                   "notify aliases_updated; return NULL; "
+                   "end;$$ language 'plpgsql'" );
+    d->t->enqueue( "create trigger aliases_trigger "
+                   "after insert or update or delete on aliases "
+                   "for each statement "
+                   "execute procedure notify_aliases()" );
+    d->t->enqueue( "create trigger aliases_users_trigger "
+                   "after insert or update or delete on users "
+                   "for each statement "
+                   "execute procedure notify_aliases()" );
+    d->t->enqueue( "create trigger aliases_scripts_trigger "
+                   "after insert or update or delete on scripts "
+                   "for each statement "
+                   "execute procedure notify_aliases()" );
+    return true;
+}
+
+
+/*! Add deliveries.next_attempt, so that SpoolManager can find the
+    deliveries which are due using an index, instead of aggregating
+    delivery_recipients for every queue run.
+*/
+
+bool Schema::stepTo97()
+{
+    describeStep( "Adding deliveries.next_attempt." );
+    d->t->enqueue( "alter table deliveries "
+                   "add next_attempt timestamp with time zone" );
+    d->t->enqueue( "update deliveries set next_attempt=("
+                   "select min(coalesce(dr.last_attempt+interval '900 s',"
+                   " deliveries.deliver_after,"
+                   " current_timestamp)) "
+                   "from delivery_recipients dr "
+                   "where dr.delivery=deliveries.id"
+                   " and (dr.action=0 or dr.action=2))" );
+    d->t->enqueue( "create index d_na on deliveries(next_attempt)" );
+    return true;
+}
+
+
+/*! Notify users_updated whenever a user or an alias changes, so that
+    servers can cache the results of User::refresh().
+*/
+
+bool Schema::stepTo98()
+{
+    describeStep( "Adding triggers to help caching users." );
+    d->t->enqueue( "create or replace function notify_users() "
+                   "returns trigger as $$ "
+                   "begin "
+                   "notify users_updated; return NULL; "
+                   "end;$$ language 'plpgsql'" );
+    d->t->enqueue( "create trigger users_trigger "
+                   "after insert or update or delete on users "
+                   "for each statement "
+                   "execute procedure notify_users()" );
+    d->t->enqueue( "create trigger users_aliases_trigger "
+                   "after insert or update or delete on aliases "
+                   "for each statement "
+                   "execute procedure notify_users()" );
+    return true;
+}
+
+
+/*! Add bodyparts.blob, for bodyparts kept in the BlobStore. */
+
+bool Schema::stepTo99()
+{
+    describeStep( "Adding bodyparts.blob." );
+    d->t->enqueue( "alter table bodyparts add blob text" );
+    d->t->enqueue( "create index b_b on bodyparts(blob) "
+                   "where blob is not null" );
+    return true;
+}
+
+
+/*! Add bodyparts.compression, so bodyparts.data can be compressed. */
+
+bool Schema::stepTo100()
+{
+    describeStep( "Adding bodyparts.compression." );
+    d->t->enqueue( "alter table bodyparts add compression smallint" );
+    return true;
+}
+
+
+/*! Notify aliases_updated only when aliases change. Servers keep the
+    active scripts separately, and reread them on scripts_updated and
+    users_updated.
+*/
+
+bool Schema::stepTo101()
+{
+    describeStep( "Notifying aliases_updated only for aliases." );
+    d->t->enqueue( "drop trigger aliases_users_trigger on users" );
+    d->t->enqueue( "drop trigger aliases_scripts_trigger on scripts" );
+    return true;
+}
@@ -120,6 +120,12 @@ private:
     bool stepTo93();
     bool stepTo94();
     bool stepTo95();
+    bool stepTo96();
+    bool stepTo97();
+    bool stepTo98();
+    bool stepTo99();
+    bool stepTo100();
+    bool stepTo101();
 
     void describeStep( const EString & );
 };
@@ -19,7 +19,8 @@ public:
           children( 0 ),
           submittedCommit( false ), submittedBegin( false ),
           committing( false ),
-          owner( 0 ), db( 0 ), queries( 0 ), failedQuery( 0 )
+          owner( 0 ), db( 0 ), queries( 0 ), failedQuery( 0 ),
+          priority( Query::Interactive )
     {}
 
     Transaction::State state;
@@ -38,6 +39,8 @@ public:
     Query * failedQuery;
     EString error;
 
+    Query::Priority priority;
+
     class CommitBouncer
         : public EventHandler
     {
@@ -145,6 +148,29 @@ Transaction * Transaction::subTransaction( EventHandler * ev )
 }
 
 
+/*! Records that this Transaction should be scheduled with priority
+    \a p. This must be called before execute(). Subtransactions use
+    their parent's database handle, so their priority is ignored.
+
+    \sa Query::setPriority()
+*/
+
+void Transaction::setPriority( Query::Priority p )
+{
+    d->priority = p;
+}
+
+
+/*! Returns the priority set by setPriority(), or Query::Interactive
+    if setPriority() hasn't been called.
+*/
+
+Query::Priority Transaction::priority() const
+{
+    return d->priority;
+}
+
+
 /*! Returns a pointer to the parent of this Transaction, which will be 0
     if this is not a subTransaction().
 */
@@ -165,8 +191,9 @@ void Transaction::setDatabase( Database *db )
     d->db = db;
 
     Scope x( d->owner->log() );
-    log( "Using database connection " + fn( db->connectionNumber() ),
-         Log::Debug );
+    if ( Log::enabled( Log::Debug ) )
+        log( "Using database connection " + fn( db->connectionNumber() ),
+             Log::Debug );
 
     if ( d->queries )
         return;
@@ -572,6 +599,7 @@ void Transaction::execute()
             TransactionData::BeginBouncer * b
                 = new TransactionData::BeginBouncer( this );
             b->q = new Query( "begin", b );
+            b->q->setPriority( d->priority );
             // ... and tell the db to shift control to us.
             b->q->setTransaction( this );
             Database::submit( b->q );
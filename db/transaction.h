@@ -4,9 +4,9 @@
 #define TRANSACTION_H
 
 #include "list.h"
+#include "query.h"
 
 
-class Query;
 class EString;
 class Database;
 class EventHandler;
@@ -36,6 +36,9 @@ public:
     void enqueue( const EString & );
     void execute();
     void rollback();
+
+    void setPriority( Query::Priority );
+    Query::Priority priority() const;
     void restart();
     void commit();
 
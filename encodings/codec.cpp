@@ -53,7 +53,7 @@
 */
 
 Codec::Codec( const char * cs )
-    : s( Valid ), n( cs )
+    : s( Valid ), n( cs ), a( false ), ms( false ), pu( 0 )
 {
 }
 
@@ -559,6 +559,24 @@ UString TableCodec::toUnicode( const EString & s )
     return u;
 }
 
+
+/*! Returns the length of \a s, since every byte in a single-byte
+    encoding can be converted on its own.
+*/
+
+uint TableCodec::decodable( const EString & s ) const
+{
+    return s.length();
+}
+
+
+/*! Returns the length of \a u. */
+
+uint TableCodec::encodable( const UString & u ) const
+{
+    return u.length();
+}
+
 /*! \fn bool Codec::wellformed() const
 
 Returns true if this codec's input has so far been well-formed, and
@@ -583,9 +601,138 @@ and false if it has.
 void Codec::reset()
 {
     setState( Valid );
+    ms = false;
+    pe.truncate();
+    pu = 0;
+}
+
+
+/*! Converts \a chunk, which is the next part of a longer input, to
+    Unicode and returns as much of the result as can be determined so
+    far. If \a last is true, \a chunk is the end of the input and all
+    remaining output is returned.
+
+    Input which cannot yet be converted safely (e.g. the first half
+    of a multibyte sequence, or the remainder of a line in a stateful
+    encoding) is kept until the next call, so the concatenation of all
+    results is the same as toUnicode() would return for the
+    concatenation of all the chunks. The codec's state() reflects all
+    input seen so far. Error positions reported by error() are
+    relative to the converted piece, not to the entire input.
+
+    Callers must not mix decodeChunk() and encodeChunk() without
+    calling reset() in between.
+*/
+
+UString Codec::decodeChunk( const EString & chunk, bool last )
+{
+    pe.append( chunk );
+    uint l = pe.length();
+    if ( !last )
+        l = decodable( pe );
+    UString r;
+    if ( l ) {
+        if ( l == pe.length() ) {
+            r = toUnicode( pe );
+            pe.truncate();
+        }
+        else {
+            r = toUnicode( pe.mid( 0, l ) );
+            pe = pe.mid( l );
+        }
+        ms = true;
+    }
+    if ( last ) {
+        ms = false;
+        pe.truncate();
+    }
+    return r;
 }
 
 
+/*! Converts \a chunk, which is the next part of a longer text, from
+    Unicode and returns as much of the result as can be produced so
+    far. If \a last is true, \a chunk is the end of the text and all
+    remaining output is returned.
+
+    This is the encoding counterpart of decodeChunk(), and the same
+    rules apply.
+*/
+
+EString Codec::encodeChunk( const UString & chunk, bool last )
+{
+    if ( !pu )
+        pu = new UString;
+    pu->append( chunk );
+    uint l = pu->length();
+    if ( !last )
+        l = encodable( *pu );
+    EString r;
+    if ( l ) {
+        if ( l == pu->length() ) {
+            r = fromUnicode( *pu );
+            pu->truncate();
+        }
+        else {
+            r = fromUnicode( pu->mid( 0, l ) );
+            *pu = pu->mid( l );
+        }
+        ms = true;
+    }
+    if ( last ) {
+        ms = false;
+        pu = 0;
+    }
+    return r;
+}
+
+
+/*! Returns the length of the longest prefix of \a s which can be
+    passed to toUnicode() without changing the meaning of the rest of
+    the input. decodeChunk() calls this to decide how much input to
+    keep for later.
+
+    This implementation is correct for all encodings where a line
+    feed always is a line feed and each line starts in the default
+    state. It returns the length up to and including the last LF,
+    or 0 if there is none. Codecs which can do better, or need more
+    care, reimplement it.
+*/
+
+uint Codec::decodable( const EString & s ) const
+{
+    uint i = s.length();
+    while ( i > 0 && s[i-1] != 10 )
+        i--;
+    return i;
+}
+
+
+/*! Returns the length of the longest prefix of \a u which can be
+    passed to fromUnicode() without changing the encoding of the
+    rest. This is the encoding counterpart of decodable(), and also
+    splits after the last LF.
+*/
+
+uint Codec::encodable( const UString & u ) const
+{
+    uint i = u.length();
+    while ( i > 0 && u[i-1] != 10 )
+        i--;
+    return i;
+}
+
+
+/*! \fn bool Codec::midStream() const
+
+    Returns true if decodeChunk() or encodeChunk() has already
+    converted some of the current input, and false if the next call
+    to toUnicode() or fromUnicode() will see the start of the input.
+    Codecs which treat the start specially (e.g. by looking for or
+    emitting a BOM) use this to avoid doing so for each chunk.
+*/
+
+
 /*! Appends \a c to \a u. If \a c isn't a legal codepoint or there are
     other errors, this codec's state is modifed appropriately.
 */
@@ -696,6 +843,24 @@ UString AsciiCodec::toUnicode( const EString & s )
     return u;
 }
 
+
+/*! Returns the length of \a s, since US-ASCII has no multibyte
+    sequences.
+*/
+
+uint AsciiCodec::decodable( const EString & s ) const
+{
+    return s.length();
+}
+
+
+/*! Returns the length of \a u. */
+
+uint AsciiCodec::encodable( const UString & u ) const
+{
+    return u.length();
+}
+
 /*! \chapter codecs
 
     \introduces AsciiCodec Codec Cp1250Codec Cp1251Codec Cp1252Codec
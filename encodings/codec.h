@@ -19,6 +19,9 @@ public:
     virtual EString fromUnicode( const UString & ) = 0;
     virtual UString toUnicode( const EString & ) = 0;
 
+    UString decodeChunk( const EString &, bool = false );
+    EString encodeChunk( const UString &, bool = false );
+
     bool wellformed() const { return state() == Valid; }
     bool valid() const { return state() != Invalid; }
 
@@ -37,18 +40,26 @@ public:
     static Codec * byString( const UString & );
     static Codec * byString( const EString & );
 
-    EString name() const { return n; }
+    EString name() const { return EString( n ); }
 
     void append( UString &, uint );
     void mangleTrailingSurrogate( UString & );
 
     static class EStringList * allCodecNames();
 
+protected:
+    virtual uint decodable( const EString & ) const;
+    virtual uint encodable( const UString & ) const;
+    bool midStream() const { return ms; }
+
 private:
     State s;
-    EString n;
+    const char * n;
     EString e;
     bool a;
+    bool ms;
+    EString pe;
+    UString * pu;
 };
 
 
@@ -61,6 +72,10 @@ public:
     EString fromUnicode( const UString & );
     UString toUnicode( const EString & );
 
+protected:
+    uint decodable( const EString & ) const;
+    uint encodable( const UString & ) const;
+
 private:
     const uint * t;
 };
@@ -72,6 +87,10 @@ public:
 
     EString fromUnicode( const UString & );
     UString toUnicode( const EString & );
+
+protected:
+    uint decodable( const EString & ) const;
+    uint encodable( const UString & ) const;
 };
 
 
@@ -167,5 +167,33 @@ UString Iso2022JpCodec::toUnicode( const EString &s )
     return u;
 }
 
+
+/*! Returns the length of \a s up to and including the last LF which
+    is seen in ASCII mode, so that the next chunk starts in the same
+    mode as toUnicode() starts.
+*/
+
+uint Iso2022JpCodec::decodable( const EString & s ) const
+{
+    bool ascii = true;
+    uint r = 0;
+    uint n = 0;
+    while ( n < s.length() ) {
+        char c = s[n];
+        if ( c == 0x1b ) {
+            if ( s[n+1] == 0x28 )
+                ascii = true;
+            else if ( s[n+1] == 0x24 )
+                ascii = false;
+            n += 2;
+        }
+        else if ( c == 10 && ascii ) {
+            r = n + 1;
+        }
+        n++;
+    }
+    return r;
+}
+
 // for charset.pl:
 //codec ISO-2022-JP Iso2022JpCodec
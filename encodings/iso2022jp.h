@@ -14,6 +14,9 @@ public:
 
     EString fromUnicode( const UString & );
     UString toUnicode( const EString & );
+
+protected:
+    uint decodable( const EString & ) const;
 };
 
 
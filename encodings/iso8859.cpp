@@ -59,6 +59,24 @@ UString Iso88591Codec::toUnicode( const EString & s )
 }
 
 
+/*! Returns the length of \a s, since 8859-1 has no multibyte
+    sequences.
+*/
+
+uint Iso88591Codec::decodable( const EString & s ) const
+{
+    return s.length();
+}
+
+
+/*! Returns the length of \a u. */
+
+uint Iso88591Codec::encodable( const UString & u ) const
+{
+    return u.length();
+}
+
+
 static const uint table88592[256] = {
 #include "8859-2.inc"
 };
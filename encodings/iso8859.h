@@ -13,6 +13,10 @@ public:
 public:
     EString fromUnicode( const UString & );
     UString toUnicode( const EString & );
+
+protected:
+    uint decodable( const EString & ) const;
+    uint encodable( const UString & ) const;
 };
 
 
@@ -175,6 +175,50 @@ UString Utf8Codec::toUnicode( const EString & s )
 }
 
 
+/*! Returns the length of \a s, less any incomplete sequence at the
+    end. A complete sequence encoding a leading surrogate is also held
+    back, so that toUnicode() can combine it with the trailing
+    surrogate in the next chunk.
+*/
+
+uint Utf8Codec::decodable( const EString & s ) const
+{
+    uint l = s.length();
+    uint i = l;
+    while ( i > 0 && l - i < 6 && ( s[i-1] & 0xc0 ) == 0x80 )
+        i--;
+    if ( i == 0 || s[i-1] < 0xc0 )
+        return l;
+    i--;
+    uint n = 0;
+    if ( (s[i] & 0xe0) == 0xc0 )
+        n = 2;
+    else if ( (s[i] & 0xf0) == 0xe0 )
+        n = 3;
+    else if ( (s[i] & 0xf8) == 0xf0 )
+        n = 4;
+    else if ( (s[i] & 0xfc) == 0xf8 )
+        n = 5;
+    else if ( (s[i] & 0xfe) == 0xfc )
+        n = 6;
+    if ( l - i < n )
+        return i;
+    if ( n == 3 && s[i] == 0xed && s[i+1] >= 0xa0 && s[i+1] < 0xb0 )
+        return i;
+    return l;
+}
+
+
+/*! Returns the length of \a u. Every code point can be encoded on its
+    own.
+*/
+
+uint Utf8Codec::encodable( const UString & u ) const
+{
+    return u.length();
+}
+
+
 /*! \class PgUtf8Codec utf.h
     The PgUtf8Codec is a simple modification of Utf8Codec to be able
     to use PostgreSQL 8.1 well.
@@ -205,6 +249,24 @@ PgUtf8Codec::PgUtf8Codec()
 
 
 
+/*! This private helper returns the length of the longest prefix of
+    \a s which can be decoded as UTF-16 (big-endian if \a be is true,
+    little-endian otherwise) without splitting a code unit or a
+    surrogate pair.
+*/
+
+static uint utf16Decodable( const EString & s, bool be )
+{
+    uint l = s.length() & ~1;
+    if ( l < 2 )
+        return 0;
+    uint c = be ? s[l-2] : s[l-1];
+    if ( c >= 0xD8 && c <= 0xDB )
+        l -= 2;
+    return l;
+}
+
+
 /*! \class Utf16Codec utf.h
     The Utf16Codec implements UTF-16 as specified in RFC 2781.
 
@@ -230,7 +292,10 @@ EString Utf16Codec::fromUnicode( const UString & u )
 {
     EString r;
 
-    if ( !bom ) {
+    if ( midStream() ) {
+        // the BOM, if any, was sent with the first chunk
+    }
+    else if ( !bom ) {
         // if we don't output a BOM, reader should assume BE, so we
         // must be BE to conform
         be = true;
@@ -255,7 +320,10 @@ EString Utf16Codec::fromUnicode( const UString & u )
 
 UString Utf16Codec::toUnicode( const EString & s )
 {
-    if ( s[0] == 0xFF && s[1] == 0xFE ) {
+    if ( midStream() ) {
+        // we looked for the BOM in the first chunk
+    }
+    else if ( s[0] == 0xFF && s[1] == 0xFE ) {
         be = false;
         bom = true;
     }
@@ -275,13 +343,37 @@ UString Utf16Codec::toUnicode( const EString & s )
         c = new Utf16LeCodec;
     UString r = c->toUnicode( s );
 
-    setState( c->state() );
+    if ( !midStream() || c->state() != Valid )
+        setState( c->state() );
     if ( c->state() == Invalid )
         recordError( c->error() );
     return r;
 }
 
 
+/*! Returns the length of the longest prefix of \a s which contains
+    only whole code units and does not end with a leading surrogate.
+    Before the first chunk has been converted, the byte order is
+    taken from the BOM, as toUnicode() would.
+*/
+
+uint Utf16Codec::decodable( const EString & s ) const
+{
+    bool b = be;
+    if ( !midStream() )
+        b = !( s[0] == 0xFF && s[1] == 0xFE );
+    return utf16Decodable( s, b );
+}
+
+
+/*! Returns the length of \a u. */
+
+uint Utf16Codec::encodable( const UString & u ) const
+{
+    return u.length();
+}
+
+
 /*! \class Utf16LeCodec utf.h
     The Utf16LeCodec implements UTF-16LE as specified in RFC 2781.
 
@@ -336,6 +428,24 @@ UString Utf16LeCodec::toUnicode( const EString & s )
 }
 
 
+/*! Returns the length of the longest prefix of \a s which contains
+    only whole code units and does not end with a leading surrogate.
+*/
+
+uint Utf16LeCodec::decodable( const EString & s ) const
+{
+    return utf16Decodable( s, false );
+}
+
+
+/*! Returns the length of \a u. */
+
+uint Utf16LeCodec::encodable( const UString & u ) const
+{
+    return u.length();
+}
+
+
 /*! \class Utf16BeCodec utf.h
     The Utf16BeCodec implements UTF-16BE as specified in RFC 2781.
 
@@ -390,6 +500,24 @@ UString Utf16BeCodec::toUnicode( const EString & s )
 }
 
 
+/*! Returns the length of the longest prefix of \a s which contains
+    only whole code units and does not end with a leading surrogate.
+*/
+
+uint Utf16BeCodec::decodable( const EString & s ) const
+{
+    return utf16Decodable( s, true );
+}
+
+
+/*! Returns the length of \a u. */
+
+uint Utf16BeCodec::encodable( const UString & u ) const
+{
+    return u.length();
+}
+
+
 /*! \class Utf7Codec utf.h
 
     The Utf7Codec class provides conversion to and from the UTF-7
@@ -15,6 +15,9 @@ public:
     UString toUnicode( const EString & );
 
 protected:
+    uint decodable( const EString & ) const;
+    uint encodable( const UString & ) const;
+
     bool pgutf;
 };
 
@@ -33,6 +36,11 @@ public:
 
     EString fromUnicode( const UString & );
     UString toUnicode( const EString & );
+
+protected:
+    uint decodable( const EString & ) const;
+    uint encodable( const UString & ) const;
+
 private:
     bool be;
     bool bom;
@@ -46,6 +54,10 @@ public:
 
     EString fromUnicode( const UString & );
     UString toUnicode( const EString & );
+
+protected:
+    uint decodable( const EString & ) const;
+    uint encodable( const UString & ) const;
 };
 
 
@@ -56,6 +68,10 @@ public:
 
     EString fromUnicode( const UString & );
     UString toUnicode( const EString & );
+
+protected:
+    uint decodable( const EString & ) const;
+    uint encodable( const UString & ) const;
 };
 
 
@@ -6,6 +6,7 @@
 #include "utf.h"
 #include "imap.h"
 #include "user.h"
+#include "graph.h"
 #include "buffer.h"
 #include "mailbox.h"
 #include "integerset.h"
@@ -71,6 +72,7 @@ public:
           error( false ),
           emittingResponses( false ),
           state( Command::Unparsed ), group( 0 ),
+          uidsKnown( false ), changesFlags( false ),
           permittedStates( 0 ),
           imap( 0 ), session( 0 ), checker( 0 ),
           mailbox( 0 ), mailboxGroup( 0 ),
@@ -96,6 +98,9 @@ public:
     bool emittingResponses;
     Command::State state;
     uint group;
+    bool uidsKnown;
+    bool changesFlags;
+    IntegerSet uids;
     Command::Error errorCode;
     EString errorText;
 
@@ -488,6 +493,9 @@ void Command::setState( State s )
             m.append( fn( ( elapsed + 499 ) / 1000 ) );
             m.append( "ms" );
             log( m, level );
+            GraphableHistogram::find( "imap_command_seconds",
+                                      "command", d->name )
+                ->addNumber( elapsed > 0 ? (uint)elapsed : 0 );
         }
         log( "Finished", Log::Debug );
         break;
@@ -558,6 +566,10 @@ uint Command::group() const
     4) STATUS, LIST. Perhaps other read-only commands that look at
        mailboxes.
 
+    Commands in groups 1, 2 and 4 only read, and may also be executed
+    concurrently with commands in the other two groups, as decided by
+    independentOf().
+
     The initial value is 0.
 */
 
@@ -567,6 +579,59 @@ void Command::setGroup( uint g )
 }
 
 
+/*! Records that this command looks at no messages in the selected
+    mailbox except those whose UIDs are in \a uids. An empty \a uids
+    means that the command doesn't look at the selected mailbox at
+    all.
+
+    If this is never called, independentOf() assumes that the command
+    may look at any message in the selected mailbox.
+*/
+
+void Command::setUidsUsed( const IntegerSet & uids )
+{
+    d->uidsKnown = true;
+    d->uids = uids;
+}
+
+
+/*! Records that this command changes the flags of the messages it
+    looks at, even though it belongs to a read-only group(). Fetch
+    uses this when it will set \seen.
+*/
+
+void Command::setChangesFlags()
+{
+    d->changesFlags = true;
+}
+
+
+/*! Returns true if this command can execute concurrently with \a
+    other, and false if one of them has to wait for the other.
+
+    Commands in the same nonzero group() are always independent, as
+    are commands in the read-only groups 1, 2 and 4 as long as
+    neither changes flags. If one of them changes flags (ie. it's a
+    FETCH which sets \seen), the two are independent only if
+    setUidsUsed() shows that they look at different messages.
+*/
+
+bool Command::independentOf( Command * other ) const
+{
+    uint a = d->group;
+    uint b = other->d->group;
+    if ( a && a == b )
+        return true;
+    if ( ( a != 1 && a != 2 && a != 4 ) || ( b != 1 && b != 2 && b != 4 ) )
+        return false;
+    if ( !d->changesFlags && !other->d->changesFlags )
+        return true;
+    if ( !d->uidsKnown || !other->d->uidsKnown )
+        return false;
+    return d->uids.intersection( other->d->uids ).isEmpty();
+}
+
+
 /*! Returns a pointer to the IMAP session to which this command
     belongs.
 */
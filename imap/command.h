@@ -46,6 +46,10 @@ public:
     uint group() const;
     void setGroup( uint );
 
+    void setUidsUsed( const IntegerSet & );
+    void setChangesFlags();
+    bool independentOf( Command * ) const;
+
     IMAP * imap() const;
 
     void respond( const EString & );
@@ -0,0 +1,311 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "flagjournal.h"
+
+#include "estringlist.h"
+#include "integerset.h"
+#include "allocator.h"
+#include "mailbox.h"
+#include "event.h"
+#include "query.h"
+#include "list.h"
+#include "map.h"
+
+
+static Map<FlagJournal> * journals = 0;
+
+// the number of messages each journal remembers, at most
+static const uint capacity = 16384;
+
+
+class FlagJournalEntry
+    : public Garbage
+{
+public:
+    FlagJournalEntry( uint u, int64 s )
+        : Garbage(), uid( u ), modseq( 0 ), snapshot( s ) {}
+
+    EStringList flags;
+    uint uid;
+    int64 modseq;
+    int64 snapshot;
+};
+
+
+class FlagJournalLoader
+    : public EventHandler
+{
+public:
+    FlagJournalLoader( FlagJournal *, const IntegerSet &, int64 );
+
+    void execute();
+
+    FlagJournal * journal;
+    bool finished;
+    IntegerSet uids;
+    int64 snapshot;
+    Query * q;
+    List<EventHandler> waiters;
+};
+
+
+class FlagJournalData
+    : public Garbage
+{
+public:
+    FlagJournalData(): mailbox( 0 ), size( 0 ) {}
+
+    Mailbox * mailbox;
+    Map<FlagJournalEntry> entries;
+    List<FlagJournalEntry> order;
+    List<FlagJournalLoader> loaders;
+    List<EventHandler> failed;
+    uint size;
+};
+
+
+/*! \class FlagJournal flagjournal.h
+
+    The FlagJournal class remembers the flags and modseq of recently
+    changed messages in one mailbox, so that all the IMAP sessions
+    which have that mailbox open can send their flag updates using one
+    set of database queries instead of one each.
+
+    When a STORE changes many messages, every session on the mailbox
+    learns about it at the same time and needs to send FETCH (FLAGS)
+    responses. The first Fetch to call ready() starts loading the
+    changed messages; the others find the load in progress and wait
+    for it, or find the result already present.
+
+    Each entry is valid as of a particular modseq: It reflects all
+    changes with lower modseqs, and possibly a few more. ready()
+    reloads any entry which is older than the caller needs. The
+    journal holds at most a few thousand messages, dropping the oldest
+    entries first, and is emptied whenever the Allocator collects
+    garbage.
+*/
+
+
+/*! Constructs an empty journal for \a mailbox. Only find() calls this. */
+
+FlagJournal::FlagJournal( Mailbox * mailbox )
+    : Cache( 1 ), d( new FlagJournalData )
+{
+    d->mailbox = mailbox;
+}
+
+
+/*! Returns the journal for \a mailbox, creating it if necessary. */
+
+FlagJournal * FlagJournal::find( Mailbox * mailbox )
+{
+    if ( !journals ) {
+        journals = new Map<FlagJournal>;
+        Allocator::addEternal( journals, "flag journals" );
+    }
+    FlagJournal * j = journals->find( mailbox->id() );
+    if ( !j ) {
+        j = new FlagJournal( mailbox );
+        journals->insert( mailbox->id(), j );
+    }
+    return j;
+}
+
+
+/*! Returns true if the journal knows the state of all messages in \a
+    uids as of \a modseq, that is, taking into account all changes
+    with modseqs lower than \a modseq.
+
+    If not, ready() starts loading those messages (unless another
+    caller already has), arranges for \a owner to be notified when
+    they have been loaded, and returns false. \a owner should then
+    call failed() and ready() again.
+*/
+
+bool FlagJournal::ready( const IntegerSet & uids, int64 modseq,
+                         EventHandler * owner )
+{
+    IntegerSet missing;
+    IntegerSet u( uids );
+    while ( !u.isEmpty() ) {
+        uint uid = u.smallest();
+        u.remove( uid );
+        FlagJournalEntry * e = d->entries.find( uid );
+        if ( !e || e->snapshot < modseq )
+            missing.add( uid );
+    }
+    if ( missing.isEmpty() )
+        return true;
+
+    List<FlagJournalLoader>::Iterator l( d->loaders );
+    while ( l && !missing.isEmpty() ) {
+        if ( l->snapshot >= modseq ) {
+            IntegerSet covered = missing.intersection( l->uids );
+            if ( !covered.isEmpty() ) {
+                missing.remove( covered );
+                if ( !l->waiters.find( owner ) )
+                    l->waiters.append( owner );
+            }
+        }
+        ++l;
+    }
+
+    if ( !missing.isEmpty() ) {
+        int64 snapshot = d->mailbox->nextModSeq();
+        if ( snapshot < modseq )
+            snapshot = modseq;
+        FlagJournalLoader * n = new FlagJournalLoader( this, missing,
+                                                       snapshot );
+        n->waiters.append( owner );
+        d->loaders.append( n );
+    }
+
+    return false;
+}
+
+
+/*! Returns true if a load which \a owner waited for has failed, and
+    forgets that. \a owner should then read the flags itself instead
+    of using the journal.
+*/
+
+bool FlagJournal::failed( EventHandler * owner )
+{
+    if ( !d->failed.find( owner ) )
+        return false;
+    d->failed.remove( owner );
+    return true;
+}
+
+
+/*! Returns the modseq of the message with \a uid, or 0 if the journal
+    doesn't know it or the message has been expunged.
+*/
+
+int64 FlagJournal::modSeq( uint uid ) const
+{
+    FlagJournalEntry * e = d->entries.find( uid );
+    if ( !e )
+        return 0;
+    return e->modseq;
+}
+
+
+/*! Returns a pointer to the list of flags set on the message with \a
+    uid, or a null pointer if the journal doesn't know the message.
+    The returned list must not be modified.
+*/
+
+EStringList * FlagJournal::flags( uint uid ) const
+{
+    FlagJournalEntry * e = d->entries.find( uid );
+    if ( !e )
+        return 0;
+    return &e->flags;
+}
+
+
+/*! Forgets all entries. Loads in progress are not affected. */
+
+void FlagJournal::clear()
+{
+    d->entries.clear();
+    d->order.clear();
+    d->size = 0;
+}
+
+
+/*! Starts loading the state of \a uids into \a j. The result is valid
+    as of \a s.
+*/
+
+FlagJournalLoader::FlagJournalLoader( FlagJournal * j,
+                                      const IntegerSet & u, int64 s )
+    : EventHandler(), journal( j ), finished( false ),
+      uids( u ), snapshot( s ), q( 0 )
+{
+    // a single statement sees a single snapshot, so the flags always
+    // match the modseq without locking anything.
+    q = new Query( "select mm.uid, mm.modseq, mm.seen, mm.deleted, "
+                   "fn.name "
+                   "from mailbox_messages mm "
+                   "left join flags f on "
+                   " (mm.mailbox=f.mailbox and mm.uid=f.uid) "
+                   "left join flag_names fn on (f.flag=fn.id) "
+                   "where mm.mailbox=$1 and mm.uid=any($2)", this );
+    q->bind( 1, j->d->mailbox->id() );
+    q->bind( 2, uids );
+    q->execute();
+}
+
+
+void FlagJournalLoader::execute()
+{
+    if ( finished || !q->done() )
+        return;
+    finished = true;
+
+    FlagJournalData * d = journal->d;
+    d->loaders.remove( this );
+
+    if ( q->failed() ) {
+        // no entries; the waiters read the flags themselves.
+        log( "Could not load flags for " + uids.set() + ": " + q->error(),
+             Log::Error );
+        List<EventHandler>::Iterator w( waiters );
+        while ( w ) {
+            EventHandler * h = w;
+            if ( !d->failed.find( h ) )
+                d->failed.append( h );
+            h->notify();
+            ++w;
+        }
+        return;
+    }
+
+    Map<FlagJournalEntry> loaded;
+    Row * r;
+    while ( ( r = q->nextRow() ) != 0 ) {
+        uint uid = r->getInt( "uid" );
+        FlagJournalEntry * e = loaded.find( uid );
+        if ( !e ) {
+            e = new FlagJournalEntry( uid, snapshot );
+            e->modseq = r->getBigint( "modseq" );
+            if ( r->getBoolean( "seen" ) )
+                e->flags.append( "\\Seen" );
+            if ( r->getBoolean( "deleted" ) )
+                e->flags.append( "\\Deleted" );
+            loaded.insert( uid, e );
+        }
+        if ( !r->isNull( "name" ) )
+            e->flags.append( r->getEString( "name" ) );
+    }
+
+    IntegerSet u( uids );
+    while ( !u.isEmpty() ) {
+        uint uid = u.smallest();
+        u.remove( uid );
+        FlagJournalEntry * e = loaded.find( uid );
+        if ( !e )
+            e = new FlagJournalEntry( uid, snapshot );
+        d->entries.insert( uid, e );
+        d->order.append( e );
+        d->size++;
+    }
+
+    uint max = capacity;
+    if ( max < uids.count() )
+        max = uids.count();
+    while ( d->size > max ) {
+        FlagJournalEntry * e = d->order.shift();
+        if ( d->entries.find( e->uid ) == e )
+            d->entries.remove( e->uid );
+        d->size--;
+    }
+
+    List<EventHandler>::Iterator w( waiters );
+    while ( w ) {
+        w->notify();
+        ++w;
+    }
+}
@@ -0,0 +1,37 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef FLAGJOURNAL_H
+#define FLAGJOURNAL_H
+
+#include "cache.h"
+
+class Mailbox;
+class IntegerSet;
+class EStringList;
+class EventHandler;
+
+
+class FlagJournal
+    : public Cache
+{
+private:
+    FlagJournal( Mailbox * );
+
+public:
+    static FlagJournal * find( Mailbox * );
+
+    bool ready( const IntegerSet &, int64, EventHandler * );
+    bool failed( EventHandler * );
+
+    int64 modSeq( uint ) const;
+    EStringList * flags( uint ) const;
+
+    void clear();
+
+private:
+    class FlagJournalData * d;
+    friend class FlagJournalLoader;
+};
+
+
+#endif
@@ -5,6 +5,9 @@
 #include "buffer.h"
 #include "imap.h"
 
+#include <stdlib.h> // getloadavg()
+#include <unistd.h> // sysconf()
+
 
 /*! \class Compress compress.h
   This Compress class implements the COMPRESS=DEFLATE extension.
@@ -15,6 +18,11 @@
 
   Our implementation is a little primitive. Interoperates with the
   latest, but doesn't contain the good ideas that were added late.
+
+  The compression level is chosen when the client issues COMPRESS,
+  based on how busy the host is at the time: level 6 normally, which
+  compresses mail almost as well as 9 at a fraction of the cost, and
+  lower levels when the CPUs are busy.
 */
 
 /*!  Constructs a handler for the deflate compression. */
@@ -35,6 +43,26 @@ void Compress::parse()
 }
 
 
+/*! Returns the zlib compression level to use for a new connection,
+    given the current load average.
+*/
+
+static uint level()
+{
+    double load[1];
+    if ( ::getloadavg( load, 1 ) < 1 )
+        return 6;
+    long cpus = ::sysconf( _SC_NPROCESSORS_ONLN );
+    if ( cpus < 1 )
+        cpus = 1;
+    if ( load[0] > cpus )
+        return 1;
+    if ( load[0] * 2 > cpus )
+        return 3;
+    return 6;
+}
+
+
 /*! Starts deflating, assuming all goes well. */
 
 void Compress::execute()
@@ -49,7 +77,7 @@ void Compress::execute()
     emitResponses();
 
     r->setCompression( Buffer::Decompressing );
-    w->setCompression( Buffer::Compressing );
+    w->setCompression( Buffer::Compressing, level() );
 
     setState( Finished );
 }
@@ -134,78 +134,86 @@ void Copy::execute()
         if ( !d->toMs )
             error( No, "Could not allocate UID and modseq in target mailbox" );
 
-        Query * q;
-
-        q = new Query( "create temporary table t ("
-                       "mailbox integer,"
-                       "uid integer,"
-                       "message integer,"
-                       "nuid integer,"
-                       "seen boolean"
-                       ")", 0 );
-        transaction()->enqueue( q );
-
-        q = new Query( "create temporary sequence s start " + fn( d->toUid ),
-                       0 );
-        transaction()->enqueue( q );
-
-        q = new Query( "insert into t "
-                       "(mailbox, uid, message, nuid, seen) "
-                       "select mailbox, uid, message, nextval('s'), seen "
-                       "from mailbox_messages "
-                       "where mailbox=$1 and uid=any($2) order by uid", 0 );
-        q->bind( 1, session()->mailbox()->id() );
-        q->bind( 2, d->set );
-        transaction()->enqueue( q );
+        // the source messages are numbered 1..n in uid order, and
+        // number i gets uid toUid+i-1 in the target. that's known
+        // in advance, so we needn't stage anything in a temporary
+        // table, and each row is copied by a single statement.
+        uint n = d->set.count();
+        EString source = "from generate_series(1,$3) as s(i) "
+                         "join mailbox_messages mm on "
+                         "(mm.mailbox=$4 and mm.uid=($5::integer[])[s.i]) ";
 
-        q = new Query( "update mailboxes "
-                       "set uidnext=nextval('s'), nextmodseq=$1 "
-                       "where id=$2",
-                       this );
-        q->bind( 1, d->toMs+1 );
-        q->bind( 2, d->mailbox->id() );
-        transaction()->enqueue( q );
-
-        transaction()->enqueue( new Query( "drop sequence s", 0 ) );
+        Query * q;
 
         q = new Query( "insert into mailbox_messages "
                        "(mailbox, uid, message, modseq, seen, deleted) "
-                       "select $1, t.nuid, message, $2, t.seen, false "
-                       "from t", 0 );
+                       "select $1, $2+s.i-1, mm.message, $6, mm.seen, false "
+                       + source, 0 );
         q->bind( 1, d->mailbox->id() );
-        q->bind( 2, d->toMs );
+        q->bind( 2, d->toUid );
+        q->bind( 3, n );
+        q->bind( 4, session()->mailbox()->id() );
+        q->bind( 5, d->set );
+        q->bind( 6, d->toMs );
         transaction()->enqueue( q );
 
         q = new Query( "insert into flags "
                        "(mailbox, uid, flag) "
-                       "select $1, t.nuid, f.flag "
-                       "from flags f join t using (mailbox, uid)", 0 );
+                       "select $1, $2+s.i-1, f.flag " + source +
+                       "join flags f using (mailbox, uid)", 0 );
         q->bind( 1, d->mailbox->id() );
+        q->bind( 2, d->toUid );
+        q->bind( 3, n );
+        q->bind( 4, session()->mailbox()->id() );
+        q->bind( 5, d->set );
         transaction()->enqueue( q );
 
         q = new Query( "insert into annotations "
                        "(mailbox, uid, owner, name, value) "
-                       "select $1, t.nuid, a.owner, a.name, a.value "
-                       "from annotations a join t using (mailbox, uid) "
-                       "where a.owner is null or a.owner=$2", 0 );
+                       "select $1, $2+s.i-1, a.owner, a.name, a.value " +
+                       source +
+                       "join annotations a using (mailbox, uid) "
+                       "where a.owner is null or a.owner=$6", 0 );
         q->bind( 1, d->mailbox->id() );
-        q->bind( 2, imap()->user()->id() );
+        q->bind( 2, d->toUid );
+        q->bind( 3, n );
+        q->bind( 4, session()->mailbox()->id() );
+        q->bind( 5, d->set );
+        q->bind( 6, imap()->user()->id() );
         transaction()->enqueue( q );
 
-        d->report = new Query( "select uid, nuid from t", 0 );
+        q = new Query( "update mailboxes "
+                       "set uidnext=$1, nextmodseq=$2 "
+                       "where id=$3", 0 );
+        q->bind( 1, d->toUid + n );
+        q->bind( 2, d->toMs+1 );
+        q->bind( 3, d->mailbox->id() );
+        transaction()->enqueue( q );
+
+        // some of the messages may have been expunged before we
+        // locked the mailbox, so we look at what was really copied.
+        d->report = new Query( "select uid from mailbox_messages "
+                               "where mailbox=$1 and uid>=$2 and uid<$3",
+                               0 );
+        d->report->bind( 1, d->mailbox->id() );
+        d->report->bind( 2, d->toUid );
+        d->report->bind( 3, d->toUid + n );
         transaction()->enqueue( d->report );
 
         if ( d->move ) {
             q = new Query(
                 "insert into deleted_messages "
                 "(mailbox,uid,message,modseq,deleted_by,reason) "
-                "select $1, t.uid, t.message, $2, $3, "
-                " 'moved to mailbox '||$4||' uid '||t.nuid "
-                "from t", 0 );
-            q->bind( 1, session()->mailbox()->id() );
-            q->bind( 2, d->fromMs );
-            q->bind( 3, imap()->user()->id() );
-            q->bind( 4, d->mailbox->name() );
+                "select $4, mm.uid, mm.message, $6, $7, "
+                " 'moved to mailbox '||$1||' uid '||($2+s.i-1) " +
+                source, 0 );
+            q->bind( 1, d->mailbox->name() );
+            q->bind( 2, d->toUid );
+            q->bind( 3, n );
+            q->bind( 4, session()->mailbox()->id() );
+            q->bind( 5, d->set );
+            q->bind( 6, d->fromMs );
+            q->bind( 7, imap()->user()->id() );
             transaction()->enqueue( q );
             q = new Query( "update mailboxes "
                            "set nextmodseq=$1 "
@@ -216,8 +224,6 @@ void Copy::execute()
             transaction()->enqueue( q );
         }
 
-        transaction()->enqueue( new Query( "drop table t", 0 ) );
-
         Mailbox::refreshMailboxes( transaction() );
 
         transaction()->commit();
@@ -241,8 +247,9 @@ void Copy::execute()
 
     while ( d->report->hasResults() ) {
         Row * r = d->report->nextRow();
-        from.add( r->getInt( "uid" ) );
-        to.add( r->getInt( "nuid" ) );
+        uint uid = r->getInt( "uid" );
+        from.add( d->set.value( uid + 1 - d->toUid ) );
+        to.add( uid );
     }
 
     if ( !from.isEmpty() )
@@ -8,6 +8,7 @@
 #include "annotation.h"
 #include "integerset.h"
 #include "estringlist.h"
+#include "flagjournal.h"
 #include "mimefields.h"
 #include "imapparser.h"
 #include "bodypart.h"
@@ -51,7 +52,7 @@ public:
     FetchData()
         : state( 0 ), peek( true ), processed( 0 ),
           changedSince( 0 ), those( 0 ), findIds( 0 ),
-          store( 0 ),
+          store( 0 ), journal( false ),
           uid( false ),
           flags( false ), envelope( false ),
           body( false ), bodystructure( false ),
@@ -68,12 +69,14 @@ public:
     IntegerSet set;
     IntegerSet remaining;
     IntegerSet expunged;
+    IntegerSet unreadable;
     Map<Message> messages;
     uint processed;
     int64 changedSince;
     Query * those;
     Query * findIds;
     Store * store;
+    bool journal;
 
     // we want to ask for...
     bool uid;
@@ -146,7 +149,10 @@ Fetch::Fetch( bool u )
     modseq greater than \a limit. The responses are sent via \a i.
 
     If \a t is non-zero, the fetch operates within a subtransaction
-    of \a t.
+    of \a t. Otherwise, unless \a a is true, the flags and modseqs
+    are read via the FlagJournal, which shares them with the other
+    sessions on the same mailbox. If the journal cannot load them,
+    the handler reads them itself.
 */
 
 Fetch::Fetch( bool f, bool a, const IntegerSet & set,
@@ -165,6 +171,8 @@ Fetch::Fetch( bool f, bool a, const IntegerSet & set,
         setTransaction( t->subTransaction( this ) );
 
     d->peek = true;
+    d->journal = f && !a && !t;
+    setUidsUsed( set );
 
     List<Command>::Iterator c( i->commands() );
     while ( c && c->state() == Command::Retired )
@@ -251,6 +259,9 @@ void Fetch::parse()
         d->needsHeader = true; // Bodypart::asText() needs mime type etc
     if ( !ok() )
         return;
+    setUidsUsed( d->set );
+    if ( !d->peek )
+        setChangesFlags();
     EStringList l;
     l.append( new EString( "Fetch <=" + fn( d->set.count() ) + " messages: " ) );
     if ( d->needsAddresses )
@@ -657,6 +668,38 @@ void Fetch::execute()
     if ( !d->peek && s->readOnly() )
         d->peek = true;
 
+    if ( d->state == 0 && d->journal ) {
+        // a flag update, which we can share with other sessions
+        FlagJournal * j = FlagJournal::find( s->mailbox() );
+        if ( j->failed( this ) )
+            d->journal = false;
+        else if ( !j->ready( d->set, s->nextModSeq(), this ) )
+            return;
+    }
+
+    if ( d->state == 0 && d->journal ) {
+        FlagJournal * j = FlagJournal::find( s->mailbox() );
+        IntegerSet changed;
+        while ( !d->set.isEmpty() ) {
+            uint uid = d->set.smallest();
+            d->set.remove( uid );
+            int64 modseq = j->modSeq( uid );
+            if ( modseq <= d->changedSince )
+                continue;
+            changed.add( uid );
+            FetchData::DynamicData * dd = new FetchData::DynamicData;
+            dd->modseq = modseq;
+            EStringList::Iterator f( j->flags( uid ) );
+            while ( f ) {
+                dd->flags.insert( f->lower(), f );
+                ++f;
+            }
+            d->dynamics.insert( uid, dd );
+        }
+        d->set = changed;
+        d->state = 1;
+    }
+
     if ( d->state == 0 ) {
         if ( !transaction() &&
              ( !d->peek ||
@@ -792,11 +835,11 @@ void Fetch::execute()
     if ( d->state == 3 ) {
         d->state = 4;
         sendFetchQueries();
-        if ( d->flags )
+        if ( d->flags && !d->journal )
             sendFlagQuery();
         if ( d->annotation )
             sendAnnotationsQuery();
-        if ( d->modseq )
+        if ( d->modseq && !d->journal )
             sendModSeqQuery();
         if ( transaction() )
             transaction()->commit();
@@ -814,6 +857,8 @@ void Fetch::execute()
         s->recordExpungedFetch( d->expunged );
         error( No, "UID(s) " + d->expunged.set() + " has/have been expunged" );
     }
+    if ( !d->unreadable.isEmpty() )
+        error( No, "Could not read UID(s) " + d->unreadable.set() );
     finish();
 }
 
@@ -849,6 +894,8 @@ void Fetch::sendFetchQueries()
     }
 
     Fetcher * f = new Fetcher( l, this, imap()->writeBuffer() );
+    f->setMinimumModSeq( session()->mailbox()->id(),
+                         session()->nextModSeq() );
     if ( d->needsAddresses && !haveAddresses )
         f->fetch( Fetcher::Addresses );
     if ( d->needsHeader && !haveHeader )
@@ -985,16 +1032,6 @@ EString Fetch::sectionData( Section * s, Message * m )
 
             ContentType * ct = bp->contentType();
             if ( !ct || ct->type() == "text" ) {
-                UString text;
-
-                if ( data.isEmpty() ) {
-                    text = bp->text();
-                }
-                else {
-                    Codec * c = new Utf8Codec;
-                    text = c->toUnicode( data );
-                }
-
                 Codec * c = 0;
                 if ( ct )
                     c = Codec::byName( ct->parameter( "charset" ) );
@@ -1002,7 +1039,26 @@ EString Fetch::sectionData( Section * s, Message * m )
                     c = new Iso88591Codec;
                 if ( !c )
                     c = new Utf8Codec;
-                data = c->fromUnicode( text );
+
+                if ( data.isEmpty() ) {
+                    data = c->fromUnicode( bp->text() );
+                }
+                else {
+                    // convert a piece at a time, so that we never
+                    // hold the entire part in Unicode form
+                    Codec * u = new Utf8Codec;
+                    EString r;
+                    r.reserve( data.length() );
+                    uint i = 0;
+                    while ( i < data.length() ) {
+                        UString t = u->decodeChunk( data.mid( i, 65536 ) );
+                        r.append( c->encodeChunk( t ) );
+                        i += 65536;
+                    }
+                    r.append( c->encodeChunk( u->decodeChunk( "", true ),
+                                              true ) );
+                    data = r;
+                }
             }
             if ( !s->binary )
                 data = data.encoded( bp->contentTransferEncoding(), 70 );
@@ -1651,6 +1707,13 @@ void Fetch::pickup()
         if ( ok ) {
             d->processed = uid;
             d->remaining.remove( uid );
+            if ( d->needsBody && !m->valid() ) {
+                // better no response than one with empty bodyparts
+                log( "Cannot fetch UID " + fn( uid ) + ": " + m->error(),
+                     Log::Error );
+                d->unreadable.add( uid );
+                continue;
+            }
             done++;
             waitFor( new ImapFetchResponse( s, this, uid ) );
         }
@@ -1658,7 +1721,8 @@ void Fetch::pickup()
 
     if ( !done )
         return;
-    log( "Processed " + fn( done ) + " messages", Log::Debug );
+    if ( Log::enabled( Log::Debug ) )
+        log( "Processed " + fn( done ) + " messages", Log::Debug );
     imap()->emitResponses();
 }
 
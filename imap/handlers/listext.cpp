@@ -9,6 +9,7 @@
 #include "imapparser.h"
 #include "address.h"
 #include "mailbox.h"
+#include "integerset.h"
 #include "query.h"
 #include "dict.h"
 #include "user.h"
@@ -90,6 +91,7 @@ Listext::Listext()
     : d( new ListextData )
 {
     setGroup( 4 );
+    setUidsUsed( IntegerSet() );
 }
 
 
@@ -322,6 +324,7 @@ void Listext::execute()
                                  this );
                 d->permissionsQuery->bind( 1, ids );
                 d->permissionsQuery->bind( 2, imap()->user()->login() );
+                d->permissionsQuery->setReadOnly( true );
                 d->permissionsQuery->execute();
             }
         }
@@ -188,6 +188,9 @@ void Sort::execute()
             ++c;
         }
         d->q->setString( t );
+        d->q->setReadOnly( true );
+        d->q->setMinimumModSeq( session()->mailbox()->id(),
+                                session()->nextModSeq() );
         d->q->execute();
     }
 
@@ -8,6 +8,7 @@
 #include "cache.h"
 #include "query.h"
 #include "mailbox.h"
+#include "integerset.h"
 #include "imapsession.h"
 #include "mailboxgroup.h"
 
@@ -170,6 +171,10 @@ void Status::parse()
 
     log( l );
     requireRight( d->mailbox, Permissions::Read );
+
+    ImapSession * s = imap()->session();
+    if ( !s || s->mailbox() != d->mailbox )
+        setUidsUsed( IntegerSet() );
 }
 
 
@@ -317,6 +322,9 @@ void Status::execute()
                          "from mailbox_messages "
                          "where mailbox=$1 and not seen", this );
         d->unseenCount->bind( 1, d->mailbox->id() );
+        d->unseenCount->setReadOnly( true );
+        d->unseenCount->setMinimumModSeq( d->mailbox->id(),
+                                          d->mailbox->nextModSeq() );
         d->unseenCount->execute();
     }
 
@@ -335,6 +343,9 @@ void Status::execute()
                          "uidnext-first_recent as recent "
                          "from mailboxes where id=$1", this );
         d->recentCount->bind( 1, d->mailbox->id() );
+        d->recentCount->setReadOnly( true );
+        d->recentCount->setMinimumModSeq( d->mailbox->id(),
+                                          d->mailbox->nextModSeq() );
         d->recentCount->execute();
     }
 
@@ -353,6 +364,9 @@ void Status::execute()
                          "$1::int as mailbox "
                          "from mailbox_messages where mailbox=$1", this );
         d->messageCount->bind( 1, d->mailbox->id() );
+        d->messageCount->setReadOnly( true );
+        d->messageCount->setMinimumModSeq( d->mailbox->id(),
+                                           d->mailbox->nextModSeq() );
         d->messageCount->execute();
     }
 
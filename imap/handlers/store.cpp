@@ -30,7 +30,7 @@ public:
     StoreData()
         : op( ReplaceFlags ), silent( false ), uid( false ),
           checkedPermission( false ),
-          seen( false ), deleted( false ),
+          seen( false ), deleted( false ), otherFlags( false ),
           unchangedSince( 0 ), seenUnchangedSince( false ),
           sentWorkQueries( false ),
           modseq( 0 ),
@@ -55,6 +55,7 @@ public:
     bool checkedPermission;
     bool seen;
     bool deleted;
+    bool otherFlags;
 
     uint unchangedSince;
     bool seenUnchangedSince;
@@ -65,6 +66,7 @@ public:
     Query * findSet;
     Query * presentFlags;
     Map<IntegerSet> * present;
+    IntegerSet presentIds;
     FlagCreator * flagCreator;
     AnnotationNameCreator * annotationNameCreator;
 
@@ -363,6 +365,7 @@ void Store::execute()
                 requireRight( m, Permissions::DeleteMessages );
             if ( other || d->flagNames.isEmpty() )
                 requireRight( m, Permissions::Write );
+            d->otherFlags = other;
         }
         d->checkedPermission = true;
     }
@@ -380,20 +383,35 @@ void Store::execute()
         d->obtainModSeq->bind( 1, m->id() );
         transaction()->enqueue( d->obtainModSeq );
 
-        Selector * work = new Selector;
-        work->add( new Selector( d->specified ) );
-        if ( d->seenUnchangedSince )
-            work->add( new Selector( Selector::Modseq, Selector::Smaller,
-                                     d->unchangedSince+1 ) );
-        work->simplify();
-        EStringList r;
-        r.append( "mailbox" );
-        r.append( "uid" );
-        d->findSet = work->query( imap()->user(), m, 0, this, false, &r );
-        EString s = d->findSet->string();
-        s.append( " order by mm.uid for update" );
-        d->findSet->setString( s );
-        transaction()->enqueue( d->findSet );
+        if ( ( d->op == StoreData::AddFlags ||
+               d->op == StoreData::RemoveFlags ) &&
+             !d->otherFlags && !d->seenUnchangedSince ) {
+            // only seen/deleted change. the update of
+            // mailbox_messages finds and locks just the rows it
+            // changes, and the mailbox lock above keeps other
+            // stores out, so there's no need to lock every
+            // specified row first.
+            d->s = d->specified;
+            shrink( &d->s );
+        }
+        else {
+            Selector * work = new Selector;
+            work->add( new Selector( d->specified ) );
+            if ( d->seenUnchangedSince )
+                work->add( new Selector( Selector::Modseq,
+                                         Selector::Smaller,
+                                         d->unchangedSince+1 ) );
+            work->simplify();
+            EStringList r;
+            r.append( "mailbox" );
+            r.append( "uid" );
+            d->findSet = work->query( imap()->user(), m, 0, this,
+                                      false, &r );
+            EString s = d->findSet->string();
+            s.append( " order by mm.uid for update" );
+            d->findSet->setString( s );
+            transaction()->enqueue( d->findSet );
+        }
 
         if  (d->op == StoreData::AddFlags ||
              d->op == StoreData::RemoveFlags ||
@@ -409,7 +427,20 @@ void Store::execute()
                     d->present->insert( id, new IntegerSet );
                 }
             }
-            if ( !s.isEmpty() ) {
+            d->presentIds.add( s );
+            if ( d->op == StoreData::ReplaceFlags ) {
+                // we need all flags, so removeFlags() can tell which
+                // ones are actually removed
+                d->presentFlags =
+                    new Query(
+                        "select mailbox, uid, flag from flags "
+                        "where mailbox=$1 and uid=any($2)",
+                        this );
+                d->presentFlags->bind( 1, m->id() );
+                d->presentFlags->bind( 2, d->specified );
+                transaction()->enqueue( d->presentFlags );
+            }
+            else if ( !s.isEmpty() ) {
                 d->presentFlags =
                     new Query(
                         "select mailbox, uid, flag from flags "
@@ -425,7 +456,7 @@ void Store::execute()
         transaction()->execute();
     }
 
-    while ( d->findSet->hasResults() )
+    while ( d->findSet && d->findSet->hasResults() )
         d->s.add( d->findSet->nextRow()->getInt( "uid" ) );
 
     if ( d->presentFlags && d->presentFlags->hasResults() ) {
@@ -434,8 +465,14 @@ void Store::execute()
         uint oldFlag = 0;
         while ( (r=d->presentFlags->nextRow()) ) {
             uint f = r->getInt( "flag" );
-            if ( !s || f != oldFlag )
+            if ( !s || f != oldFlag ) {
                 s = d->present->find( f );
+                if ( !s ) {
+                    s = new IntegerSet;
+                    d->present->insert( f, s );
+                    d->presentIds.add( f );
+                }
+            }
             oldFlag = f;
             s->add( r->getInt( "uid" ) );
         }
@@ -450,7 +487,7 @@ void Store::execute()
             return;
     }
 
-    if ( !d->findSet->done() )
+    if ( d->findSet && !d->findSet->done() )
         return;
 
     if ( d->presentFlags && !d->presentFlags->done() )
@@ -688,19 +725,16 @@ bool Store::processAnnotationNames()
     database. If \a opposite, removes all other flags, but leaves the
     specified flags.
 
-    Returns true if it enqueues a query and false if it does not.
+    Only the flags which are actually present are removed, using a
+    single query, and only the messages which lose a flag are recorded
+    as changed.
 
-    This is a not ideal for the case where a single flag is removed
-    from a single messages or from a simple range of messages. In that
-    case, we could use a PreparedStatement. Later.
+    Returns true if it enqueues a query and false if it does not.
 */
 
 bool Store::removeFlags( bool opposite )
 {
-    IntegerSet flags;
-
-    IntegerSet unchanged;
-    unchanged.add( d->specified );
+    IntegerSet specified;
     EStringList::Iterator i( d->flagNames );
     while ( i ) {
         uint id = 0;
@@ -709,17 +743,25 @@ bool Store::removeFlags( bool opposite )
         if ( !id )
             id = Flag::id( *i );
         ++i;
-        if ( id ) {
-            IntegerSet * present = d->present->find( id );
-            if ( present && !present->isEmpty() ) {
+        if ( id )
+            specified.add( id );
+    }
+
+    IntegerSet flags;
+    IntegerSet changed;
+    IntegerSet candidates( opposite ? d->presentIds : specified );
+    while ( !candidates.isEmpty() ) {
+        uint id = candidates.smallest();
+        candidates.remove( id );
+        IntegerSet * present = d->present->find( id );
+        if ( present && !( opposite && specified.contains( id ) ) ) {
+            IntegerSet affected = present->intersection( d->s );
+            if ( !affected.isEmpty() ) {
                 flags.add( id );
-                unchanged = unchanged.intersection( *present );
+                changed.add( affected );
             }
         }
     }
-    IntegerSet changed;
-    changed.add( d->specified );
-    changed.remove( unchanged );
     d->changedUids.add( changed );
 
     if ( ( d->seen && !opposite ) ||
@@ -733,25 +775,23 @@ bool Store::removeFlags( bool opposite )
         d->newDeleted = false;
     }
 
-    if ( flags.isEmpty() && !opposite )
+    if ( flags.isEmpty() )
         return false;
 
-    EString s = "delete from flags where mailbox=$1 and uid=any($2) and ";
-    if ( opposite )
-        s.append( "not " );
-    s.append( "flag=any($3)" );
-
-    Query * q = new Query( s, 0 );
+    Query * q = new Query( "delete from flags "
+                           "where mailbox=$1 and uid=any($2) "
+                           "and flag=any($3)", 0 );
     q->bind( 1, d->session->mailbox()->id() );
-    q->bind( 2, d->s );
+    q->bind( 2, changed );
     q->bind( 3, flags );
     transaction()->enqueue( q );
     return true;
 }
 
 
-/*! Adds all the necessary flags to the database. Returns true if it
-    sends any queries.
+/*! Adds all the necessary flags to the database, using a single
+    COPY for the flags which aren't already present. Returns true if
+    it sends any queries.
 */
 
 bool Store::addFlags()
@@ -785,6 +825,7 @@ bool Store::addFlags()
                 s.remove( *p );
             if ( !s.isEmpty() ) {
                 work = true;
+                d->changedUids.add( s );
                 int c = s.count();
                 while ( c ) {
                     uint uid = s.value( c );
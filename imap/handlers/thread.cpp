@@ -6,6 +6,7 @@
 #include "imapparser.h"
 #include "message.h"
 #include "address.h"
+#include "mailbox.h"
 #include "field.h"
 #include "query.h"
 #include "dict.h"
@@ -165,7 +166,9 @@ void Thread::execute()
                    " and tmid.part='') " + ts + x );
 
         d->find->setString( j );
-
+        d->find->setReadOnly( true );
+        d->find->setMinimumModSeq( session()->mailbox()->id(),
+                                   session()->nextModSeq() );
         d->find->execute();
         return;
     }
@@ -128,9 +128,11 @@ public:
 
     The IMAP class parses incoming commands as soon as possible and
     may keep several commands executing at a time, if the client
-    issues that. It depends on Command::group() to decide whether each
-    parsed Command can be executed concurrently with the already
-    running Command objects.
+    issues that. It depends on Command::group() and
+    Command::independentOf() to decide whether each parsed Command
+    can be executed concurrently with the already running Command
+    objects. Tagged responses are always sent in the order the client
+    issued the commands.
 */
 
 /*! This setup function expects to be called from ::main().
@@ -369,7 +371,8 @@ void IMAP::addCommand()
     d->nextOkTime = time( 0 ) + 117;
 
     Scope x( cmd->log() );
-    if ( name.lower() != "login" && name.lower() != "authenticate" )
+    if ( Log::enabled( Log::Debug ) &&
+         name.lower() != "login" && name.lower() != "authenticate" )
         ::log( "First line: " + p->firstLine(), Log::Debug );
 }
 
@@ -585,8 +588,9 @@ void IMAP::runCommands()
 
     while ( d->runCommandsAgain ) {
         d->runCommandsAgain = false;
-        log( "IMAP::runCommands, " + fn( d->commands.count() ) + " commands",
-             Log::Debug );
+        if ( Log::enabled( Log::Debug ) )
+            log( "IMAP::runCommands, " + fn( d->commands.count() ) +
+                 " commands", Log::Debug );
 
         // run all currently executing commands once
         uint n = 0;
@@ -657,23 +661,28 @@ void IMAP::runCommands()
         }
 
         // if we have a leading command, we can parse and execute
-        // followers in the same group.
+        // followers which are independent of all the commands
+        // executing before them. we stop at the first one which
+        // isn't, so that commands never overtake each other.
         if ( first && first->group() ) {
-            while ( first && i && first->state() == i->state() ) {
+            while ( first && i ) {
                 Command * c = i;
                 Scope x( c->log() );
                 ++i;
                 if ( c->state() == Command::Unparsed )
                     c->parse();
-                if ( !c->ok() )
+                if ( !c->ok() ) {
                     c->setState( Command::Finished );
+                }
                 else if ( c->state() == Command::Unparsed ||
-                          c->state() == Command::Blocked )
-                    c->setState( Command::Executing );
-                if ( c->group() != first->group() &&
-                     c->state() == Command::Executing ) {
-                    first = 0;
-                    c->setState( Command::Blocked );
+                          c->state() == Command::Blocked ) {
+                    if ( independent( c ) ) {
+                        c->setState( Command::Executing );
+                    }
+                    else {
+                        c->setState( Command::Blocked );
+                        first = 0;
+                    }
                 }
             }
         }
@@ -698,6 +707,25 @@ void IMAP::runCommands()
 }
 
 
+/*! Returns true if \a c is independent of every command executing
+    before it, and false if it has to wait for one of them to finish.
+*/
+
+bool IMAP::independent( Command * c ) const
+{
+    List<Command>::Iterator i( d->commands );
+    while ( i ) {
+        Command * e = i;
+        if ( e == c )
+            return true;
+        if ( e->state() == Command::Executing && !c->independentOf( e ) )
+            return false;
+        ++i;
+    }
+    return true;
+}
+
+
 /*! Executes \a c once, provided it's in the right state, and emits its
     responses.
 */
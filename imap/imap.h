@@ -72,6 +72,7 @@ private:
 
     void addCommand();
     void runCommands();
+    bool independent( Command * ) const;
     void run( Command * );
 };
 
@@ -428,6 +428,11 @@ void ImapUrlFetcher::execute()
                 d->owner->execute();
                 return;
             }
+            else if ( !it->message->valid() ) {
+                setError( "Could not read message", it->url->orig() );
+                d->owner->execute();
+                return;
+            }
             else if ( it->section ) {
                 it->url->setText( Fetch::sectionData( it->section,
                                                       it->message ) );
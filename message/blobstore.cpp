@@ -0,0 +1,302 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "blobstore.h"
+
+#include "configuration.h"
+#include "estringlist.h"
+#include "estring.h"
+#include "allocator.h"
+#include "sha256.h"
+#include "file.h"
+#include "log.h"
+
+#include <sys/types.h> // open(), mkdir()
+#include <sys/stat.h> // open(), mkdir(), stat()
+#include <unistd.h> // write(), fsync(), close(), getpid()
+#include <stdio.h> // rename()
+#include <fcntl.h> // open()
+#include <utime.h> // utime()
+#include <dirent.h> // opendir(), readdir(), closedir()
+#include <errno.h>
+#include <zlib.h> // deflate(), inflate()
+
+
+/*! \class BlobStore blobstore.h
+    Keeps large bodyparts in files outside the database.
+
+    If the blob-store configuration variable names a directory, the
+    Injector stores each non-text bodypart larger than blob-threshold
+    there, and the bodyparts row keeps only its size, MD5 hash and the
+    name of the file. The Fetcher reads the file when the bodypart is
+    fetched.
+
+    The files are content-addressed: Each is named by the SHA-256 hash
+    of its contents, so two identical attachments share a file, and a
+    file never changes once written. If blob-compression is enabled,
+    new files are compressed with zlib and their names end in ".z".
+    Such a file holds one complete zlib stream, so fetch() can tell a
+    damaged or truncated file from a good one.
+
+    Nothing here ever deletes a file that's in use. "aox vacuum"
+    calls remove() for files whose bodyparts rows it has deleted, and
+    remove() leaves alone any file that was stored (or found to exist
+    already) recently, in case a concurrent Injector has just decided
+    to reuse it. "aox vacuum -f" also uses list() to find files which
+    no row mentions, e.g. because the Injector's transaction failed,
+    and remove()s those.
+
+    This class has only static functions.
+*/
+
+
+/*! Returns true if blob-store is set, and false if all bodyparts are
+    stored in the database.
+*/
+
+bool BlobStore::enabled()
+{
+    return !Configuration::text( Configuration::BlobStore ).isEmpty();
+}
+
+
+/*! Returns the size above which the Injector should store() a
+    bodypart rather than write it to the database.
+*/
+
+uint BlobStore::threshold()
+{
+    return Configuration::scalar( Configuration::BlobThreshold );
+}
+
+
+/*! Returns the path name of the file \a name in the blob store, taking
+    the server's chroot jail into account.
+*/
+
+static EString path( const EString & name )
+{
+    return File::chrooted( Configuration::text( Configuration::BlobStore ) +
+                           "/" + name );
+}
+
+
+/*! Returns \a s compressed as one complete zlib stream, or an empty
+    string if zlib fails.
+*/
+
+static EString deflated( const EString & s )
+{
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    if ( ::deflateInit( &zs, Z_DEFAULT_COMPRESSION ) != Z_OK )
+        return "";
+
+    uint max = ::deflateBound( &zs, s.length() );
+    char * out = (char*)Allocator::alloc( max, 0 );
+    zs.next_in = (Bytef*)s.data();
+    zs.avail_in = s.length();
+    zs.next_out = (Bytef*)out;
+    zs.avail_out = max;
+    int r = ::deflate( &zs, Z_FINISH );
+    uint l = max - zs.avail_out;
+    ::deflateEnd( &zs );
+    if ( r != Z_STREAM_END )
+        return "";
+    return EString( out, l );
+}
+
+
+/*! Returns the contents of the zlib stream \a s, or an empty string
+    if \a s is not one complete, undamaged zlib stream.
+*/
+
+static EString inflated( const EString & s )
+{
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = (Bytef*)s.data();
+    zs.avail_in = s.length();
+    if ( ::inflateInit( &zs ) != Z_OK )
+        return "";
+
+    EString r;
+    r.reserve( s.length() * 4 );
+    char buffer[32768];
+    int z = Z_OK;
+    while ( z == Z_OK ) {
+        zs.next_out = (Bytef*)buffer;
+        zs.avail_out = sizeof( buffer );
+        z = ::inflate( &zs, Z_NO_FLUSH );
+        r.append( buffer, sizeof( buffer ) - zs.avail_out );
+    }
+    ::inflateEnd( &zs );
+    if ( z != Z_STREAM_END )
+        return "";
+    return r;
+}
+
+
+/*! Stores \a data in the blob store and returns the name of the file,
+    or returns an empty string and logs an error if \a data could not
+    be stored. In the latter case the caller should store \a data in
+    the database as usual.
+
+    If the file exists already, store() updates its modification time
+    and doesn't write it again.
+
+    Otherwise, store() writes and fsyncs the file before returning, so
+    the process serves no other connections meanwhile. The fsync is
+    necessary, since the caller is about to commit a row referring to
+    the file. blob-threshold keeps this to large bodyparts.
+*/
+
+EString BlobStore::store( const EString & data )
+{
+    bool compress = Configuration::toggle( Configuration::BlobCompression );
+    EString hex = SHA256::hash( data ).hex();
+    EString dir = hex.mid( 0, 2 ) + "/" + hex.mid( 2, 2 );
+    EString name = dir + "/" + hex;
+    if ( compress )
+        name.append( ".z" );
+
+    EString p = path( name );
+    if ( ::utime( p.cstr(), 0 ) == 0 )
+        return name;
+
+    EString d = path( hex.mid( 0, 2 ) );
+    if ( ::mkdir( d.cstr(), 0700 ) < 0 && errno != EEXIST ) {
+        ::log( "Cannot create " + d, Log::Error );
+        return "";
+    }
+    d = path( dir );
+    if ( ::mkdir( d.cstr(), 0700 ) < 0 && errno != EEXIST ) {
+        ::log( "Cannot create " + d, Log::Error );
+        return "";
+    }
+
+    EString contents = data;
+    if ( compress ) {
+        contents = deflated( data );
+        if ( contents.isEmpty() ) {
+            ::log( "Cannot compress " + p, Log::Error );
+            return "";
+        }
+    }
+
+    // we write a temporary file and rename it, so that a file with
+    // the right name always has the right contents.
+    EString tmp = p + "." + fn( getpid() ) + ".tmp";
+    int fd = ::open( tmp.cstr(), O_WRONLY|O_CREAT|O_TRUNC, 0600 );
+    if ( fd < 0 ) {
+        ::log( "Cannot create " + tmp, Log::Error );
+        return "";
+    }
+    uint done = 0;
+    while ( done < contents.length() ) {
+        int r = ::write( fd, contents.data() + done,
+                         contents.length() - done );
+        if ( r <= 0 )
+            break;
+        done += r;
+    }
+    bool ok = done == contents.length();
+    if ( ::fsync( fd ) < 0 )
+        ok = false;
+    if ( ::close( fd ) < 0 )
+        ok = false;
+    if ( ok && ::rename( tmp.cstr(), p.cstr() ) < 0 )
+        ok = false;
+    if ( !ok ) {
+        ::log( "Cannot write " + p, Log::Error );
+        ::unlink( tmp.cstr() );
+        return "";
+    }
+
+    return name;
+}
+
+
+/*! Returns the contents of the file \a name, which must have been
+    returned by store(). Logs an error and returns an empty string if
+    the file cannot be read. store() is used only for large bodyparts,
+    so an empty string always means failure, and the caller must not
+    mistake it for an empty bodypart.
+*/
+
+EString BlobStore::fetch( const EString & name )
+{
+    File f( Configuration::text( Configuration::BlobStore ) + "/" + name );
+    if ( !f.valid() ) {
+        ::log( "Cannot read " + f.name(), Log::Error );
+        return "";
+    }
+    if ( !name.endsWith( ".z" ) )
+        return f.contents();
+
+    EString r = inflated( f.contents() );
+    if ( r.isEmpty() )
+        ::log( "Cannot decompress " + f.name(), Log::Error );
+    return r;
+}
+
+
+/*! Deletes the file \a name, provided it was last stored or reused
+    before \a before (a time_t), and returns true if it did. The
+    caller must make sure that no bodyparts row refers to \a name.
+*/
+
+bool BlobStore::remove( const EString & name, uint before )
+{
+    EString p = path( name );
+    struct stat st;
+    if ( ::stat( p.cstr(), &st ) < 0 || (uint)st.st_mtime >= before )
+        return false;
+    return ::unlink( p.cstr() ) == 0;
+}
+
+
+/*! Returns the names of the files in one part of the blob store: \a n
+    (0-255) selects the files whose names begin with those two hex
+    digits. Unfinished temporary files are included.
+
+    The blob store is split into 256 parts so that the caller can
+    check each part against the database without holding the names
+    of all files in memory.
+*/
+
+EStringList * BlobStore::list( uint n )
+{
+    EStringList * l = new EStringList;
+    EString top = EString::fromNumber( n, 16 );
+    if ( top.length() < 2 )
+        top = "0" + top;
+
+    DIR * dp = ::opendir( path( top ).cstr() );
+    if ( !dp )
+        return l;
+    EStringList dirs;
+    struct dirent * de;
+    while ( ( de = ::readdir( dp ) ) != 0 ) {
+        if ( de->d_name[0] != '.' )
+            dirs.append( top + "/" + de->d_name );
+    }
+    ::closedir( dp );
+
+    EStringList::Iterator i( dirs );
+    while ( i ) {
+        dp = ::opendir( path( *i ).cstr() );
+        if ( dp ) {
+            while ( ( de = ::readdir( dp ) ) != 0 ) {
+                if ( de->d_name[0] != '.' )
+                    l->append( *i + "/" + de->d_name );
+            }
+            ::closedir( dp );
+        }
+        ++i;
+    }
+    return l;
+}
@@ -0,0 +1,31 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include "global.h"
+
+
+class EString;
+class EStringList;
+
+
+class BlobStore
+    : public Garbage
+{
+public:
+    static bool enabled();
+    static uint threshold();
+
+    static EString store( const EString & );
+    static EString fetch( const EString & );
+    static bool remove( const EString &, uint );
+
+    static EStringList * list( uint );
+
+private:
+    BlobStore();
+};
+
+
+#endif
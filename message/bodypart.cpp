@@ -13,6 +13,8 @@
 #include "iso2022jp.h"
 #include "mimefields.h"
 
+#include <string.h> // memcmp()
+
 
 class BodypartData
     : public Garbage
@@ -319,12 +321,14 @@ void Bodypart::parseMultipart( uint i, uint end,
     uint start = 0;
     bool last = false;
     uint pn = 1;
+    const char * s = rfc2822.data();
+    uint dl = divider.length();
     while ( !last && i <= end ) {
         if ( i >= end ||
              ( rfc2822[i] == '-' && rfc2822[i+1] == '-' &&
                ( i == 0 || rfc2822[i-1] == 13 || rfc2822[i-1] == 10 ) &&
-               rfc2822[i+2] == divider[0] &&
-               rfc2822.mid( i+2, divider.length() ) == divider ) )
+               dl && i + 2 + dl <= rfc2822.length() &&
+               !memcmp( s + i + 2, divider.data(), dl ) ) )
         {
             uint j = i;
             bool l = false;
@@ -376,14 +380,37 @@ void Bodypart::parseMultipart( uint i, uint end,
                 i = j;
             }
         }
-        while ( i < end && rfc2822[i] != 13 && rfc2822[i] != 10 )
-            i++;
+        // boundaries only occur at the start of a line, so skip to
+        // the next one.
+        if ( i < end ) {
+            int n = rfc2822.findLineBreak( i );
+            if ( n < 0 || (uint)n > end )
+                i = end;
+            else
+                i = n;
+        }
         while ( i < end && ( rfc2822[i] == 13 || rfc2822[i] == 10 ) )
             i++;
     }
 }
 
 
+/*! Feeds \a body to \a c a piece at a time and discards the output,
+    so that c->state() reflects all of \a body without the entire
+    Unicode form ever being held in memory.
+*/
+
+static void probe( Codec * c, const EString & body )
+{
+    uint i = 0;
+    while ( i < body.length() ) {
+        (void)c->decodeChunk( body.mid( i, 65536 ) );
+        i += 65536;
+    }
+    (void)c->decodeChunk( "", true );
+}
+
+
 static Codec * guessTextCodec( const EString & body )
 {
     // step 1. try iso-2022-jp. this goes first because it's so
@@ -393,14 +420,14 @@ static Codec * guessTextCodec( const EString & body )
          ( body[1] == '(' || body[1] == '$' ) &&
          ( body[2] == 'B' || body[2] == 'J' || body[2] == '@' ) ) {
         Codec * c = new Iso2022JpCodec;
-        c->toUnicode( body );
+        probe( c, body );
         if ( c->wellformed() )
             return c;
     }
 
     // step 2. could it be pure ascii?
     Codec * a = new AsciiCodec;
-    (void)a->toUnicode( body );
+    probe( a, body );
     if ( a->wellformed() )
         return a;
 
@@ -411,7 +438,7 @@ static Codec * guessTextCodec( const EString & body )
 
     // step 3. does it look good as utf-8?
     Codec * u = new Utf8Codec;
-    (void)u->toUnicode( body );
+    probe( u, body );
     if ( u->wellformed() ) {
         // if it's actually ascii, return that.
         if ( a->valid() )
@@ -423,7 +450,7 @@ static Codec * guessTextCodec( const EString & body )
     Codec * g = Codec::byString( body );
     if ( g ) {
         // this probably isn't necessary... but it doesn't hurt to be sure.
-        (void)g->toUnicode( body );
+        probe( g, body );
         if ( g->wellformed() )
             return g;
     }
@@ -446,7 +473,7 @@ static Codec * guessHtmlCodec( const EString & body )
     // works.
     if ( !guess ) {
         guess = new Iso88591Codec;
-        (void)guess->toUnicode( body );
+        probe( guess, body );
         if ( !guess->valid() )
             guess = 0;
     }
@@ -458,7 +485,7 @@ static Codec * guessHtmlCodec( const EString & body )
         // Some people believe that Windows codepage 1252 is
         // ISO-8859-1. Let's see if that works.
         Codec * windoze = new Cp1252Codec;
-        (void)windoze->toUnicode( body );
+        probe( windoze, body );
         if ( windoze->wellformed() )
             guess = windoze;
     }
@@ -592,7 +619,7 @@ Bodypart * Bodypart::parseBodypart( uint start, uint end,
                 // Content-Type field - without checking whether the
                 // body actually is ASCII. If it isn't, we'd better
                 // call our charset guesser.
-                (void)c->toUnicode( body );
+                probe( c, body );
                 if ( !c->valid() )
                     specified = false;
                 // Not pretty.
@@ -0,0 +1,157 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "compressor.h"
+
+#include "configuration.h"
+#include "mimefields.h"
+#include "allocator.h"
+#include "estring.h"
+#include "log.h"
+
+#include <zlib.h>
+
+
+// Strings that occur in most HTML mail. zlib gives the end of the
+// dictionary the shortest distances, so the most common strings are
+// at the end. This must never change: Every Deflate bodypart in every
+// database depends on it. A better dictionary needs a new Method.
+static const char dictionary[] =
+    "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01 Transitional//EN\">"
+    "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Transitional//EN\" "
+    "\"http://www.w3.org/TR/xhtml1/DTD/xhtml1-transitional.dtd\">"
+    "<html xmlns=\"http://www.w3.org/1999/xhtml\">"
+    "<meta http-equiv=\"Content-Type\" content=\"text/html; "
+    "charset=utf-8\"><meta name=\"viewport\" content=\"width=device-width, "
+    "initial-scale=1.0\">unsubscribe</a>privacy policy"
+    "font-family: Arial, Helvetica, sans-serif; font-size: 12px; "
+    "font-weight: bold; line-height: 1.5; text-decoration: none; "
+    "margin: 0; padding: 0; border: 0; background-color: #ffffff; "
+    "color: #000000; text-align: left; vertical-align: top; "
+    "<table width=\"100%\" cellpadding=\"0\" cellspacing=\"0\" "
+    "border=\"0\" align=\"center\"><tbody><tr><td valign=\"top\" "
+    "style=\"<img src=\"https://\" alt=\"\" width=\"\" height=\"\" "
+    "style=\"display: block;\" /></td></tr></tbody></table>"
+    "<a href=\"https://www.\" target=\"_blank\">&nbsp;</a>"
+    "<blockquote type=\"cite\"><div class=\"\"><span style=\""
+    "</span></div><br></div><p class=\"MsoNormal\"><o:p></o:p></p>"
+    "<div dir=\"ltr\"><br></div></body></html>\r\n";
+
+
+/*! \class Compressor compressor.h
+    Compresses and decompresses bodyparts.data.
+
+    The Injector uses compress() for bodyparts that are stored as
+    data (non-text parts and the HTML source of text/html parts) and
+    records the Method in bodyparts.compression. The Fetcher
+    reverses that with decompress().
+
+    bodyparts.text isn't compressed, since searching needs it, and
+    the tsearch index is built from it.
+
+    Deflate uses zlib with a fixed preset dictionary of strings common
+    in HTML mail, which helps mostly for small parts.
+*/
+
+
+/*! Returns true if it's worth trying to compress a bodypart of type
+    \a ct and \a size bytes, and false if the bodypart is small or
+    probably compressed already.
+*/
+
+bool Compressor::worthTrying( ContentType * ct, uint size )
+{
+    if ( !Configuration::toggle( Configuration::CompressBodyparts ) )
+        return false;
+    if ( size < 256 )
+        return false;
+    if ( !ct )
+        return true;
+    EString t = ct->type();
+    EString s = ct->subtype();
+    if ( t == "image" || t == "audio" || t == "video" )
+        return false;
+    if ( t == "application" &&
+         ( s == "zip" || s == "gzip" || s == "x-gzip" ||
+           s == "x-bzip2" || s == "x-7z-compressed" ||
+           s == "x-rar-compressed" || s == "pkcs7-signature" ||
+           s.startsWith( "vnd.openxmlformats" ) ||
+           s.startsWith( "vnd.oasis.opendocument" ) ) )
+        return false;
+    return true;
+}
+
+
+/*! Returns \a s compressed using the Deflate method, or an empty
+    string if zlib fails.
+*/
+
+EString Compressor::compress( const EString & s )
+{
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    if ( ::deflateInit( &zs, Z_DEFAULT_COMPRESSION ) != Z_OK )
+        return "";
+    ::deflateSetDictionary( &zs, (const Bytef*)dictionary,
+                            sizeof( dictionary ) - 1 );
+
+    uint max = ::deflateBound( &zs, s.length() );
+    char * out = (char*)Allocator::alloc( max, 0 );
+    zs.next_in = (Bytef*)s.data();
+    zs.avail_in = s.length();
+    zs.next_out = (Bytef*)out;
+    zs.avail_out = max;
+    int r = ::deflate( &zs, Z_FINISH );
+    uint l = max - zs.avail_out;
+    ::deflateEnd( &zs );
+    if ( r != Z_STREAM_END )
+        return "";
+    return EString( out, l );
+}
+
+
+/*! Returns \a s decompressed using \a method, which must be a
+    Compressor::Method. Logs an error and returns an empty string if
+    \a s cannot be decompressed.
+*/
+
+EString Compressor::decompress( const EString & s, uint method )
+{
+    if ( method == None )
+        return s;
+    if ( method != Deflate ) {
+        ::log( "Unknown bodypart compression method " + fn( method ),
+               Log::Error );
+        return "";
+    }
+
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = (Bytef*)s.data();
+    zs.avail_in = s.length();
+    if ( ::inflateInit( &zs ) != Z_OK )
+        return "";
+
+    EString r;
+    r.reserve( s.length() * 4 );
+    char buffer[32768];
+    int z = Z_OK;
+    while ( z == Z_OK ) {
+        zs.next_out = (Bytef*)buffer;
+        zs.avail_out = sizeof( buffer );
+        z = ::inflate( &zs, Z_NO_FLUSH );
+        if ( z == Z_NEED_DICT )
+            z = ::inflateSetDictionary( &zs, (const Bytef*)dictionary,
+                                        sizeof( dictionary ) - 1 );
+        r.append( buffer, sizeof( buffer ) - zs.avail_out );
+    }
+    ::inflateEnd( &zs );
+    if ( z != Z_STREAM_END ) {
+        ::log( "Cannot decompress bodypart", Log::Error );
+        return "";
+    }
+    return r;
+}
@@ -0,0 +1,28 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include "global.h"
+
+
+class EString;
+class ContentType;
+
+
+class Compressor
+    : public Garbage
+{
+public:
+    enum Method { None = 0, Deflate = 1 };
+
+    static bool worthTrying( ContentType *, uint );
+    static EString compress( const EString & );
+    static EString decompress( const EString &, uint );
+
+private:
+    Compressor();
+};
+
+
+#endif
@@ -7,6 +7,8 @@
 #include "integerset.h"
 #include "allocator.h"
 #include "bodypart.h"
+#include "blobstore.h"
+#include "compressor.h"
 #include "selector.h"
 #include "postgres.h"
 #include "mailbox.h"
@@ -37,16 +39,21 @@ public:
           state( NotStarted ),
           maxBatchSize( 32768 ),
           batchSize( 0 ),
+          batchBytes( 0 ),
+          averageBytes( 0 ),
+          lastBatchFinished( 0 ),
           uniqueDatabaseIds( true ),
-          lastBatchStarted( 0 ),
-          addresses( 0 ), otherheader( 0 ),
-          body( 0 ), trivia( 0 ),
-          partnumbers( 0 ),
+          mailbox( 0 ), modseq( 0 ),
+          addresses( false ), otherheader( false ),
+          body( false ), trivia( false ),
+          partnumbers( false ),
           throttler( 0 )
     {}
 
+    class Batch;
+
     List<Message> messages;
-    Map< List<Message> > batch;
+    List<Batch> batches;
     EventHandler * owner;
     List<Query> * q;
     Transaction * transaction;
@@ -55,15 +62,19 @@ public:
     State state;
     uint maxBatchSize;
     uint batchSize;
+    uint batchBytes;
+    uint averageBytes;
+    uint lastBatchFinished;
     bool uniqueDatabaseIds;
-    uint lastBatchStarted;
+    uint mailbox;
+    int64 modseq;
 
     class Decoder
         : public EventHandler
     {
     public:
-        Decoder( FetcherData * fd )
-            : q( 0 ), d( fd ) {
+        Decoder( FetcherData * fd, Batch * b )
+            : q( 0 ), d( fd ), batch( b ) {
             setLog( new Log );
         }
         void execute();
@@ -73,21 +84,35 @@ public:
         virtual bool isDone( Message * ) const = 0;
         Query * q;
         FetcherData * d;
+        Batch * batch;
         List<Row> mr;
     };
 
-    Decoder * addresses;
-    Decoder * otherheader;
-    Decoder * body;
-    Decoder * trivia;
-    Decoder * partnumbers;
+    class Batch
+        : public Garbage
+    {
+    public:
+        Batch(): count( 0 ), planned( 0 ), bytes( 0 ), started( 0 ) {}
+        Map< List<Message> > messages;
+        List<Decoder> decoders;
+        uint count;
+        uint planned;
+        uint bytes;
+        uint started;
+    };
+
+    bool addresses;
+    bool otherheader;
+    bool body;
+    bool trivia;
+    bool partnumbers;
 
     class TriviaDecoder
         : public Decoder
     {
     public:
-        TriviaDecoder( FetcherData * fd )
-            : Decoder( fd ) {}
+        TriviaDecoder( FetcherData * fd, Batch * b )
+            : Decoder( fd, b ) {}
         void decode( Message *, List<Row> * );
         void setDone( Message * );
         bool isDone( Message * ) const;
@@ -97,7 +122,7 @@ public:
         : public Decoder
     {
     public:
-        AddressDecoder( FetcherData * fd ): Decoder( fd ) {}
+        AddressDecoder( FetcherData * fd, Batch * b ): Decoder( fd, b ) {}
         void decode( Message *, List<Row> * );
         void setDone( Message * );
         bool isDone( Message * ) const;
@@ -107,7 +132,7 @@ public:
         : public Decoder
     {
     public:
-        HeaderDecoder( FetcherData * fd ): Decoder( fd ) {}
+        HeaderDecoder( FetcherData * fd, Batch * b ): Decoder( fd, b ) {}
         void decode( Message *, List<Row> * );
         void setDone( Message * );
         bool isDone( Message * ) const;
@@ -117,7 +142,8 @@ public:
         : public Decoder
     {
     public:
-        PartNumberDecoder( FetcherData * fd ): Decoder( fd ) {}
+        PartNumberDecoder( FetcherData * fd, Batch * b )
+            : Decoder( fd, b ) {}
         void decode( Message *, List<Row> * );
         void setDone( Message * );
         bool isDone( Message * ) const;
@@ -127,16 +153,42 @@ public:
         : public PartNumberDecoder
     {
     public:
-        BodyDecoder( FetcherData * fd ): PartNumberDecoder( fd ) {}
+        BodyDecoder( FetcherData * fd, Batch * b )
+            : PartNumberDecoder( fd, b ) {}
         void decode( Message *, List<Row> * );
         void setDone( Message * );
         bool isDone( Message * ) const;
     };
 
     Buffer * throttler;
+
+    void limitBatchBytes();
 };
 
 
+/*! Reduces batchBytes if the memory-limit doesn't leave room for it.
+
+    There may be two batches in flight, and the decoded messages need
+    about as much RAM again as the rows did, so each batch may use a
+    quarter of what's left. This applies to the first two batches as
+    well as the later ones, since they are prepared at the same time.
+*/
+
+void FetcherData::limitBatchBytes()
+{
+    uint limit = 1024 * 1024 *
+                 Configuration::scalar( Configuration::MemoryLimit );
+    uint already = Allocator::inUse() + Allocator::allocated();
+    uint left = 0;
+    if ( limit > already )
+        left = limit - already;
+    if ( batchBytes > left / 4 )
+        batchBytes = left / 4;
+    if ( batchBytes < 32 * averageBytes )
+        batchBytes = 32 * averageBytes; // just sanity
+}
+
+
 /*! \class Fetcher fetcher.h
 
     The Fetcher class retrieves Message data for some/all messages in
@@ -150,6 +202,10 @@ public:
     an SQL select for them. Typically the select ends with
     "mailbox=$71 and uid in any($72). When the Fetcher isn't useful
     any more, its owner drops it on the floor.
+
+    The messages are fetched in batches whose size is measured in
+    bytes, and the Fetcher keeps up to two batches in flight so the
+    database needn't wait while the owner formats the results.
 */
 
 
@@ -270,7 +326,7 @@ void Fetcher::start()
     if ( d->body ) {
         n++;
         what.append( "body" );
-        d->partnumbers = 0;
+        d->partnumbers = false;
     }
     if ( d->trivia ) {
         n++;
@@ -291,52 +347,92 @@ void Fetcher::start()
          what.join( " " ) );
 
     // we'll use two steps. first, we find a good size for the first
-    // batch.
-    d->batchSize = 4096;
+    // batch, using a guess at the size of each message.
+    uint count = 4096;
     if ( d->body )
-        d->batchSize = d->batchSize / 2;
+        count = count / 2;
     if ( d->otherheader )
-        d->batchSize = d->batchSize * 2 / 3;
+        count = count * 2 / 3;
     if ( d->addresses )
-        d->batchSize = d->batchSize * 3 / 4;
-    if ( Postgres::version() < 80200 && d->batchSize > 50 && d->otherheader )
+        count = count * 3 / 4;
+    d->averageBytes = 2 * 1024;
+    if ( d->body )
+        d->averageBytes = 40 * 1024;
+    d->batchBytes = count * d->averageBytes;
+    d->limitBatchBytes();
+    d->batchSize = d->maxBatchSize;
+    if ( Postgres::version() < 80200 && d->otherheader )
         d->batchSize = 50;
 
     d->state = Fetching;
-    prepareBatch();
-    makeQueries();
 }
 
 
-/*! Checks whether all queries and decoders are done. When the
-    decoders are, then the Fetcher may or may not be. Perhaps it's
-    time to start another batch, perhaps it's time to notify the
+/*! Checks whether all queries and decoders are done for the oldest
+    batch. When they are, then the Fetcher may or may not be. Perhaps
+    it's time to start another batch, perhaps it's time to notify the
     owner.
+
+    Up to two batches are in flight at once, so that the database can
+    work on the next batch while the owner formats the previous one.
 */
 
 
 void Fetcher::waitForEnd()
 {
-    List<FetcherData::Decoder> decoders;
-    if ( d->addresses )
-        decoders.append( d->addresses );
-    if ( d->otherheader )
-        decoders.append( d->otherheader );
-    if ( d->body )
-        decoders.append( d->body );
-    if ( d->trivia )
-        decoders.append( d->trivia );
-    if ( d->partnumbers )
-        decoders.append( d->partnumbers );
+    bool progress = false;
+    while ( !d->batches.isEmpty() ) {
+        FetcherData::Batch * b = d->batches.firstElement();
+        List<FetcherData::Decoder>::Iterator i( b->decoders );
+        while ( i && ( !i->q || i->q->done() ) )
+            ++i;
+        if ( i )
+            break;
+        finishBatch();
+        progress = true;
+    }
 
-    List<FetcherData::Decoder>::Iterator i( decoders );
-    while ( i ) {
-        if ( i->q && !i->q->done() )
-            return;
-        ++i;
+    uint lanes = 2;
+    if ( d->transaction || Database::numHandles() < 2 )
+        lanes = 1;
+
+    if ( d->messages.isEmpty() ) {
+        if ( d->batches.isEmpty() ) {
+            d->state = Done;
+            if ( d->transaction )
+                d->transaction->commit();
+        }
+    }
+    else if ( d->throttler && d->throttler->size() > 1024*1024 ) {
+        if ( d->batches.isEmpty() )
+            (void)new Timer( this, 2 );
     }
+    else {
+        while ( !d->messages.isEmpty() && d->batches.count() < lanes ) {
+            prepareBatch();
+            makeQueries();
+        }
+    }
+    if ( d->owner && ( progress || d->state == Done ) )
+        d->owner->notify();
+}
+
+
+/*! Marks the messages in the oldest batch as fetched, removes the
+    batch and adjusts the size of the next batches so we'll get about
+    one batch every 6 seconds.
+
+    The batch size is measured in bytes, not messages, so that a
+    mailbox with a few huge messages and many tiny ones is fetched at
+    an even pace. The average message size is learned from the rows
+    the decoders actually receive.
+*/
 
-    Map< List<Message> >::Iterator bi( d->batch );
+void Fetcher::finishBatch()
+{
+    FetcherData::Batch * b = d->batches.shift();
+
+    Map< List<Message> >::Iterator bi( b->messages );
     while ( bi ) {
         List<Message>::Iterator li( *bi );
         ++bi;
@@ -344,7 +440,7 @@ void Fetcher::waitForEnd()
             Message * m = li;
             ++li;
 
-            List<FetcherData::Decoder>::Iterator di( decoders );
+            List<FetcherData::Decoder>::Iterator di( b->decoders );
             while ( di ) {
                 di->setDone( m );
                 ++di;
@@ -352,124 +448,101 @@ void Fetcher::waitForEnd()
         }
     }
 
-    if ( d->messages.isEmpty() ) {
-        d->state = Done;
-        if ( d->transaction )
-            d->transaction->commit();
+    if ( b->count )
+        d->averageBytes = ( d->averageBytes + b->bytes / b->count ) / 2;
+    if ( d->averageBytes < 256 )
+        d->averageBytes = 256;
+
+    // the batches overlap, so we measure from the end of the previous
+    // batch, if that's later than the start of this one.
+    uint now = (uint)time( 0 );
+    uint from = b->started;
+    if ( d->lastBatchFinished > from )
+        from = d->lastBatchFinished;
+    d->lastBatchFinished = now;
+
+    uint prev = d->batchBytes;
+    if ( now == from ) {
+        // if we took zero time, let's do a small batch size
+        // increase, because that's suspiciously fast.
+        d->batchBytes = prev * 2;
     }
-    else if ( d->throttler && d->throttler->size() > 1024*1024 ) {
-        (void)new Timer( this, 2 );
+    else if ( now < from ) {
+        // if time went backwards we're very, very careful.
+        d->batchBytes = 128 * d->averageBytes;
     }
     else {
-        prepareBatch();
-        makeQueries();
+        // we adjust the batch size so the next batch could take
+        // something in the approximate region of 6 seconds.
+        d->batchBytes = (uint)( (int64)b->planned * 6 / ( now - from ) );
     }
-    if ( d->owner )
-        d->owner->notify();
+
+    // the batch size can't increase too much, and we generally
+    // don't want it to be too small
+    if ( d->batchBytes > prev * 3 )
+        d->batchBytes = prev * 3;
+    if ( d->batchBytes < 64 * 1024 )
+        d->batchBytes = 64 * 1024;
+
+    // if we're memory-constrained, then we adjust the batch size to
+    // the amount of RAM we have left.
+    d->limitBatchBytes();
+
+    if ( prev != d->batchBytes && Log::enabled( Log::Debug ) )
+        log( "Batch time was " + fn( now - from ) +
+             " for " + fn( b->count ) + " messages (" +
+             fn( b->planned ) + " bytes), adjusting to " +
+             fn( d->batchBytes ) + " bytes", Log::Debug );
 }
 
 
 /*! Messages are fetched in batches, so that we can deliver some rows
-    early on. This function adjusts the size of the batches so we'll
-    get about one batch every 6 seconds, and updates the tables so we
-    have a batch ready for reading.
+    early on. This function takes messages off the queue until the
+    next batch is about as large as finishBatch() thinks suitable,
+    and fills in a new batch so we can tie responses to the Message
+    objects.
+
+    If we're fetching bodies and already know the RFC 822 size of a
+    message, that is used as its size. Otherwise the average size of
+    the messages fetched so far is used.
 */
 
-
 void Fetcher::prepareBatch()
 {
-    uint now = (uint)time( 0 );
-    if ( d->lastBatchStarted ) {
-        uint prevBatchSize = d->batchSize;
-        if ( now == d->lastBatchStarted ) {
-            // if we took zero time, let's do a small batch size
-            // increase, because that's suspiciously fast.
-            d->batchSize = d->batchSize * 2;
-        }
-        else if ( now < d->lastBatchStarted ) {
-            // if time went backwards we're very, very careful.
-            d->batchSize = 128;
-        }
-        else {
-            // we adjust the batch size so the next batch could take
-            // something in the approximate region of 6 seconds.
-            uint diff = now - d->lastBatchStarted;
-            d->batchSize = d->batchSize * 6 / diff;
-        }
+    FetcherData::Batch * b = new FetcherData::Batch;
+    b->started = (uint)time( 0 );
 
-        // the batch size can't increase too much
-        if ( d->batchSize > prevBatchSize * 3 )
-            d->batchSize = prevBatchSize * 3;
-        if ( d->batchSize > prevBatchSize + 2000 )
-            d->batchSize = prevBatchSize + 2000;
-
-        // and we generally don't want it to be too large or small
-        if ( d->batchSize < 128 )
-            d->batchSize = 128;
-        if ( d->batchSize > d->maxBatchSize )
-            d->batchSize = d->maxBatchSize;
-
-        // if we're memory-constrained, then we adjust the batch size
-        // to the amount of RAM we'll probably use. the amount of RAM
-        // we use per message is higher if we'll issue all queries in
-        // sequence, lower if we issue them in parallel. both 40k and
-        // 80k are dreadful estimates, some messages are many-megabyte
-        // monsters, others just 4k.
-        uint limit = 1024 * 1024 *
-                     Configuration::scalar( Configuration::MemoryLimit );
-        uint already = Allocator::inUse() + Allocator::allocated();
-        uint perMessage = 40 * 1024;
-        if ( d->transaction || Database::numHandles() < 2 )
-            perMessage = 80 * 1024;
-        uint batchSizeLimit = ( limit - already ) / perMessage;
-        if ( batchSizeLimit < 32 )
-            batchSizeLimit = 32; // just sanity, shouldn't actually hit
-        if ( d->batchSize > batchSizeLimit )
-            d->batchSize = batchSizeLimit;
-
-        // finally, if pg is old enough to misplan =any(...) and the
-        // often-misplanned query would be run, then we keep the batch
-        // size properly down
-        if ( Postgres::version() < 80200 &&
-             d->batchSize > 50 &&
-             d->otherheader )
-            d->batchSize = 50;
-
-        if ( prevBatchSize != d->batchSize )
-            log( "Batch time was " + fn ( now - d->lastBatchStarted ) +
-                 " for " + fn( prevBatchSize ) + " messages, adjusting to " +
-                 fn( d->batchSize ), Log::Debug );
-    }
-    d->lastBatchStarted = now;
-
-    // Find out which messages we're going to fetch, and fill in the
-    // batch array so we can tie responses to the Message objects.
     d->uniqueDatabaseIds = true;
-    d->batch.clear();
-    uint n = 0;
-    while ( !d->messages.isEmpty() && n < d->batchSize ) {
+    while ( !d->messages.isEmpty() && b->count < d->batchSize &&
+            ( !b->count || b->planned < d->batchBytes ) ) {
         Message * m = d->messages.shift();
-        List<Message> * l = d->batch.find( m->databaseId() );
+        List<Message> * l = b->messages.find( m->databaseId() );
         if ( !l ) {
             l = new List<Message>;
-            d->batch.insert( m->databaseId(), l );
+            b->messages.insert( m->databaseId(), l );
         }
         l->append( m );
-        n++;
+        b->count++;
+        if ( d->body && m->hasTrivia() && !m->hasBodies() )
+            b->planned += m->rfc822Size();
+        else
+            b->planned += d->averageBytes;
     }
+
+    d->batches.append( b );
 }
 
 
 
 
-/*! Finds out which messages need information of \a type, and binds a
-    list of their database IDs to parameter \a n of \a query.
+/*! Finds out which messages in the newest batch need information of
+    \a type, and returns a set of their database IDs.
 */
 
-void Fetcher::bindIds( Query * query, uint n, Type type )
+IntegerSet Fetcher::ids( Type type ) const
 {
     IntegerSet l;
-    Map< List<Message> >::Iterator bi( d->batch );
+    Map< List<Message> >::Iterator bi( d->batches.last()->messages );
     while ( bi ) {
         List<Message>::Iterator li( *bi );
         ++bi;
@@ -503,46 +576,52 @@ void Fetcher::bindIds( Query * query, uint n, Type type )
                 l.add( m->databaseId() );
         }
     }
-    query->bind( n, l );
+    return l;
 }
 
 
-/*! Issues the necessary selects to retrieve data and feed the
-    decoders. This function does some optimisation of the generated
-    SQL.
+/*! Issues the necessary selects to retrieve data for the newest batch
+    and feed the decoders. This function does some optimisation of
+    the generated SQL.
+
+    Each kind of data is fetched by a separate query, so the queries
+    can run on different database handles. The bodies are usually the
+    bulk of the data, so the body query is split further if there are
+    idle handles to run the parts.
 */
 
 void Fetcher::makeQueries()
 {
-    EStringList wanted;
-    wanted.append( "mailbox" );
-    wanted.append( "uid" );
-    wanted.append( "message" );
-
+    FetcherData::Batch * b = d->batches.last();
+    FetcherData::Decoder * dec = 0;
     Query * q = 0;
-    EString r;
 
     if ( d->partnumbers && !d->body ) {
         // body (below) will handle this as a side effect
+        dec = new FetcherData::PartNumberDecoder( d, b );
         q = new Query( "select message, part, bytes, lines "
                        "from part_numbers where message=any($1) "
                        "order by message, part",
-                       d->partnumbers );
-        bindIds( q, 1, PartNumbers );
+                       dec );
+        q->bind( 1, ids( PartNumbers ) );
+        dec->q = q;
+        b->decoders.append( dec );
         submit( q );
-        d->partnumbers->q = q;
     }
 
     if ( d->trivia ) {
         // don't need to order this - just one row per message
+        dec = new FetcherData::TriviaDecoder( d, b );
         q = new Query( "select id as message, idate, rfc822size "
-                       "from messages where id=any($1)", d->trivia );
-        bindIds( q, 1, Trivia );
+                       "from messages where id=any($1)", dec );
+        q->bind( 1, ids( Trivia ) );
+        dec->q = q;
+        b->decoders.append( dec );
         submit( q );
-        d->trivia->q = q;
     }
 
     if ( d->addresses ) {
+        dec = new FetcherData::AddressDecoder( d, b );
         q = new Query( "select af.message, "
                        "af.part, af.position, af.field, af.number, "
                        "a.name, a.localpart, a.domain "
@@ -550,35 +629,66 @@ void Fetcher::makeQueries()
                        "join addresses a on (af.address=a.id) "
                        "where af.message=any($1) "
                        "order by af.message, af.part, af.field, af.number",
-                       d->addresses );
-        bindIds( q, 1, Addresses );
+                       dec );
+        q->bind( 1, ids( Addresses ) );
+        dec->q = q;
+        b->decoders.append( dec );
         submit( q );
-        d->addresses->q = q;
     }
 
     if ( d->otherheader ) {
+        dec = new FetcherData::HeaderDecoder( d, b );
         q = new Query( "select hf.message, hf.part, hf.position, "
                        "fn.name, hf.value from header_fields hf "
                        "join field_names fn on (hf.field=fn.id) "
                        "where hf.message=any($1) "
                        "order by hf.message, hf.part",
-                       d->otherheader );
-        bindIds( q, 1, OtherHeader );
+                       dec );
+        q->bind( 1, ids( OtherHeader ) );
+        dec->q = q;
+        b->decoders.append( dec );
         submit( q );
-        d->otherheader->q = q;
     }
 
     if ( d->body ) {
-        q = new Query( "select pn.message, pn.part, bp.text, bp.data, "
-                       "bp.bytes as rawbytes, pn.bytes, pn.lines "
-                       "from part_numbers pn "
-                       "left join bodyparts bp on (pn.bodypart=bp.id) "
-                       "where pn.message=any($1) "
-                       "order by pn.message, pn.part",
-                       d->body );
-        bindIds( q, 1, Body );
-        submit( q );
-        d->body->q = q;
+        IntegerSet all( ids( Body ) );
+
+        // each part should be worth a round-trip, and we leave a
+        // handle for other sessions.
+        uint parts = 1;
+        if ( !d->transaction && Database::idleHandles() > 2 )
+            parts = Database::idleHandles() - 1;
+        if ( parts > 4 )
+            parts = 4;
+        if ( parts > all.count() / 64 )
+            parts = all.count() / 64;
+        if ( parts < 1 )
+            parts = 1;
+
+        uint i = 1;
+        uint p = 0;
+        while ( p < parts ) {
+            IntegerSet some;
+            uint end = all.count() * ( p + 1 ) / parts;
+            while ( i <= end ) {
+                some.add( all.value( i ) );
+                i++;
+            }
+            dec = new FetcherData::BodyDecoder( d, b );
+            q = new Query( "select pn.message, pn.part, bp.text, bp.data, "
+                           "bp.blob, bp.compression, bp.bytes as rawbytes, "
+                           "pn.bytes, pn.lines "
+                           "from part_numbers pn "
+                           "left join bodyparts bp on (pn.bodypart=bp.id) "
+                           "where pn.message=any($1) "
+                           "order by pn.message, pn.part",
+                           dec );
+            q->bind( 1, some );
+            dec->q = q;
+            b->decoders.append( dec );
+            submit( q );
+            p++;
+        }
     }
 
     if ( d->transaction )
@@ -612,7 +722,7 @@ void FetcherData::Decoder::process()
     if ( mr.isEmpty() )
         return;
     uint id = mr.firstElement()->getInt( "message" );
-    List<Message> * l = d->batch.find( id );
+    List<Message> * l = batch->messages.find( id );
     if ( !l )
         return;
     List<Message>::Iterator i( l );
@@ -658,6 +768,7 @@ void FetcherData::HeaderDecoder::decode( Message * m, List<Row> * rows )
         HeaderField * f = HeaderField::assemble( name, value );
         f->setPosition( r->getInt( "position" ) );
         h->add( f );
+        batch->bytes += name.length() + value.length() + 4;
     }
 }
 
@@ -722,6 +833,8 @@ void FetcherData::AddressDecoder::decode( Message * m, List<Row> * rows )
                                    r->getEString( "localpart" ),
                                    r->getEString( "domain" ) );
         f->addresses()->append( a );
+        batch->bytes += a->uname().length() + a->localpart().length() +
+                        a->domain().length() + 8;
     }
 }
 
@@ -752,13 +865,30 @@ void FetcherData::BodyDecoder::decode( Message * m, List<Row> * rows )
     if ( !part.endsWith( ".rfc822" ) ) {
         Bodypart * bp = m->bodypart( part, true );
 
-        if ( !r->isNull( "data" ) )
+        if ( !r->isNull( "data" ) && !r->isNull( "compression" ) ) {
+            EString raw = r->getEString( "data" );
+            EString data =
+                Compressor::decompress( raw, r->getInt( "compression" ) );
+            if ( data.isEmpty() && !raw.isEmpty() )
+                m->setError( "Cannot decompress bodypart " + part );
+            bp->setData( data );
+        }
+        else if ( !r->isNull( "data" ) )
             bp->setData( r->getEString( "data" ) );
+        else if ( !r->isNull( "blob" ) ) {
+            EString data = BlobStore::fetch( r->getEString( "blob" ) );
+            if ( data.isEmpty() )
+                m->setError( "Cannot read bodypart " + part +
+                             " from the blob store" );
+            bp->setData( data );
+        }
         else if ( !r->isNull( "text" ) )
             bp->setText( r->getUString( "text" ) );
 
-        if ( !r->isNull( "rawbytes" ) )
+        if ( !r->isNull( "rawbytes" ) ) {
             bp->setNumBytes( r->getInt( "rawbytes" ) );
+            batch->bytes += r->getInt( "rawbytes" );
+        }
     }
     }
 }
@@ -850,25 +980,20 @@ void Fetcher::fetch( Type t )
     Scope x( log() );
     switch ( t ) {
     case Addresses:
-        if ( !d->addresses )
-            d->addresses = new FetcherData::AddressDecoder( d );
+        d->addresses = true;
         break;
     case OtherHeader:
-        if ( !d->otherheader )
-            d->otherheader = new FetcherData::HeaderDecoder( d );
+        d->otherheader = true;
         break;
     case Body:
-        if ( !d->body )
-            d->body = new FetcherData::BodyDecoder( d );
+        d->body = true;
         fetch( PartNumbers );
         break;
     case Trivia:
-        if ( !d->trivia )
-            d->trivia = new FetcherData::TriviaDecoder( d );
+        d->trivia = true;
         break;
     case PartNumbers:
-        if ( !d->partnumbers )
-            d->partnumbers = new FetcherData::PartNumberDecoder( d );
+        d->partnumbers = true;
         break;
     }
 }
@@ -882,19 +1007,19 @@ bool Fetcher::fetching( Type t ) const
 {
     switch ( t ) {
     case Addresses:
-        return d->addresses != 0;
+        return d->addresses;
         break;
     case OtherHeader:
-        return d->otherheader != 0;
+        return d->otherheader;
         break;
     case Body:
-        return d->body != 0;
+        return d->body;
         break;
     case Trivia:
-        return d->trivia != 0;
+        return d->trivia;
         break;
     case PartNumbers:
-        return d->partnumbers != 0;
+        return d->partnumbers;
         break;
     }
     return false; // not reached
@@ -913,14 +1038,34 @@ void Fetcher::setTransaction( class Transaction * t )
 }
 
 
+/*! Records that the messages being fetched are all visible in the
+    mailbox with id \a mailbox before its nextmodseq reached \a
+    modseq, so that the Fetcher may use any database replica that has
+    caught up that far. By default, the Fetcher uses only the primary
+    database server, since it may be asked to fetch messages that were
+    injected a moment ago.
+*/
+
+void Fetcher::setMinimumModSeq( uint mailbox, int64 modseq )
+{
+    d->mailbox = mailbox;
+    d->modseq = modseq;
+}
+
+
 /*! This internal helper makes sure \a q is executed by the
     database.
 */
 
 void Fetcher::submit( Query * q )
 {
-    if ( d->transaction )
+    if ( d->transaction ) {
         d->transaction->enqueue( q );
-    else
-        q->execute();
+        return;
+    }
+    if ( d->mailbox ) {
+        q->setReadOnly( true );
+        q->setMinimumModSeq( d->mailbox, d->modseq );
+    }
+    q->execute();
 }
@@ -42,6 +42,7 @@ public:
     bool done() const;
 
     void setTransaction( class Transaction * );
+    void setMinimumModSeq( uint, int64 );
 
 private:
     class FetcherData * d;
@@ -51,8 +52,9 @@ private:
     void prepareBatch();
     void makeQueries();
     void waitForEnd();
+    void finishBatch();
     void submit( Query * );
-    void bindIds( Query *, uint, Type );
+    IntegerSet ids( Type ) const;
 };
 
 
@@ -12,6 +12,8 @@
 #include "ustring.h"
 #include "mailbox.h"
 #include "bodypart.h"
+#include "blobstore.h"
+#include "compressor.h"
 #include "datefield.h"
 #include "mimefields.h"
 #include "messagecache.h"
@@ -38,14 +40,16 @@ struct BodypartRow
     : public Garbage
 {
     BodypartRow()
-        : id( 0 ), text( 0 ), data( 0 ), bytes( 0 )
+        : id( 0 ), text( 0 ), data( 0 ), bytes( 0 ), compression( 0 )
     {}
 
     uint id;
     EString hash;
     EString * text;
     EString * data;
+    EString blob;
     uint bytes;
+    uint compression;
     List<Bodypart> bodyparts;
 };
 
@@ -1142,11 +1146,13 @@ void Injector::insertBodyparts()
             Query * create =
                 new Query( "create temporary table bp ("
                            "bid integer, bytes integer, "
-                           "hash text, text text, data bytea, "
+                           "hash text, text text, data bytea, blob text, "
+                           "compression integer, "
                            "i integer, n boolean default 'f')", 0 );
 
             Query * copy =
-                new Query( "copy bp (bytes,hash,text,data,i) "
+                new Query( "copy bp (bytes,hash,text,data,blob,"
+                           "compression,i) "
                            "from stdin with binary", this );
 
             uint i = 0;
@@ -1164,7 +1170,15 @@ void Injector::insertBodyparts()
                     copy->bind( 4, *br->data );
                 else
                     copy->bindNull( 4 );
-                copy->bind( 5, i++ );
+                if ( !br->blob.isEmpty() )
+                    copy->bind( 5, br->blob );
+                else
+                    copy->bindNull( 5 );
+                if ( br->compression )
+                    copy->bind( 6, br->compression );
+                else
+                    copy->bindNull( 6 );
+                copy->bind( 7, i++ );
                 copy->submitLine();
 
                 ++bi;
@@ -1181,7 +1195,10 @@ void Injector::insertBodyparts()
             Query * setId =
                 new Query( "update bp set bid=b.id from bodyparts b where "
                            "bp.hash=b.hash and not bp.text is distinct from "
-                           "b.text and not bp.data is distinct from b.data",
+                           "b.text and not bp.data is distinct from b.data "
+                           "and not bp.blob is distinct from b.blob "
+                           "and not bp.compression is distinct from "
+                           "b.compression",
                            0 );
 
             Query * setNew =
@@ -1190,8 +1207,8 @@ void Injector::insertBodyparts()
 
             d->insert =
                 new Query( "insert into bodyparts "
-                           "(id,bytes,hash,text,data) "
-                           "select bid,bytes,hash,text,data "
+                           "(id,bytes,hash,text,data,blob,compression) "
+                           "select bid,bytes,hash,text,data,blob,compression "
                            "from bp where n", this );
 
             d->substate++;
@@ -1336,6 +1353,22 @@ void Injector::addBodypartRow( Bodypart * b )
         br->text = text;
         br->data = data;
         br->bytes = b->numBytes();
+        // large non-text parts go to the blob store if there is one.
+        // text stays here, since searching needs it.
+        if ( data && data->length() > BlobStore::threshold() &&
+             BlobStore::enabled() ) {
+            br->blob = BlobStore::store( *data );
+            if ( !br->blob.isEmpty() )
+                br->data = 0;
+        }
+        // and smaller ones are compressed, if that helps enough.
+        if ( br->data && Compressor::worthTrying( ct, data->length() ) ) {
+            EString z = Compressor::compress( *data );
+            if ( !z.isEmpty() && z.length() < data->length() * 9 / 10 ) {
+                br->data = new EString( z );
+                br->compression = Compressor::Deflate;
+            }
+        }
         d->hashes.insert( hash, br );
         d->bodyparts.append( br );
     }
@@ -1824,9 +1857,11 @@ void Injector::insertDeliveries()
 
         Query * q =
             new Query( "insert into deliveries "
-                       "(sender,message,injected_at,expires_at,deliver_after) "
+                       "(sender,message,injected_at,expires_at,deliver_after,"
+                       "next_attempt) "
                        "values ($1,$2,current_timestamp,"
-                       "current_timestamp+interval '2 weeks',$3)", 0 );
+                       "current_timestamp+interval '2 weeks',$3,"
+                       "coalesce($3,current_timestamp))", 0 );
         q->bind( 1, sender->id() );
         q->bind( 2, di->message->databaseId() );
         if ( di->later )
@@ -1857,7 +1892,8 @@ void Injector::insertDeliveries()
         Header * h = di->message->header();
         if ( h && h->field( "Auto-Submitted" ) && !di->later ) {
             q = new Query( "update deliveries "
-                           "set deliver_after=injected_at+'1 minute'::interval "
+                           "set deliver_after=injected_at+'1 minute'::interval"
+                           ", next_attempt=injected_at+'1 minute'::interval "
                            "where message=$1 and exists ("
                            "(select dr.id from delivery_recipients dr"
                            " join addresses a on (dr.recipient=a.id)"
@@ -206,8 +206,11 @@ Header * Message::parseHeader( uint & i, uint end,
             j++;
         if ( j == i + 4 && m == Header::Rfc2822 &&
              rfc2822.mid( i, j-i+1 ).lower() == "from " ) {
-            while ( i < end && rfc2822[i] != '\r' && rfc2822[i] != '\n' )
-                i++;
+            int n = rfc2822.findLineBreak( i );
+            if ( n < 0 || (uint)n > end )
+                i = end;
+            else
+                i = n;
             while ( rfc2822[i] == '\r' )
                 i++;
             if ( rfc2822[i] == '\n' )
@@ -219,18 +222,30 @@ Header * Message::parseHeader( uint & i, uint end,
             i++;
             while ( rfc2822[i] == ' ' || rfc2822[i] == '\t' )
                 i++;
+            // the value ends at the first LF not followed by
+            // whitespace.
             j = i;
-            // this isn't at all pretty, is it...
-            while ( j < rfc2822.length() &&
-                    ( rfc2822[j] != '\n' ||
-                      ( rfc2822[j] == '\n' &&
-                        ( rfc2822[j+1] == ' ' || rfc2822[j+1] == '\t' ) ) ) )
+            while ( j < rfc2822.length() ) {
+                int n = rfc2822.find( '\n', j );
+                if ( n < 0 )
+                    j = rfc2822.length();
+                else
+                    j = n;
+                if ( n < 0 ||
+                     ( rfc2822[j+1] != ' ' && rfc2822[j+1] != '\t' ) )
+                    break;
                 j++;
+            }
             if ( j && rfc2822[j-1] == '\r' )
                 j--;
-            EString value = rfc2822.mid( i, j-i );
-            if ( !value.simplified().isEmpty() ||
-                 name.lower().startsWith( "x-" ) ) {
+            // skip fields that are empty, except x-fields
+            uint k = i;
+            while ( k < j && ( rfc2822[k] == ' ' || rfc2822[k] == '\t' ||
+                               rfc2822[k] == '\r' || rfc2822[k] == '\n' ) )
+                k++;
+            if ( k < j || ( ( name[0] == 'x' || name[0] == 'X' ) &&
+                            name[1] == '-' ) ) {
+                EString value = rfc2822.mid( i, j-i );
                 HeaderField * f = HeaderField::create( name, value );
                 h->add( f );
             }
@@ -268,6 +283,18 @@ EString Message::error() const
 }
 
 
+/*! Records that \a error makes this message unusable, even though
+    its syntax may be correct. The Fetcher uses this when it cannot
+    read a bodypart, so that its users can report an error instead of
+    sending an empty bodypart. valid() returns false afterwards.
+*/
+
+void Message::setError( const EString & error )
+{
+    d->error = error;
+}
+
+
 /*! Returns the message formatted in RFC 822 (actually 2822) format.
     The return value is a canonical expression of the message, not
     whatever was parsed.
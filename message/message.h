@@ -25,6 +25,7 @@ public:
     bool valid() const;
     EString error() const;
     void recomputeError();
+    void setError( const EString & );
 
     EString rfc822() const;
     EString body() const;
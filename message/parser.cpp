@@ -98,7 +98,8 @@ EString EmailParser::comment()
 {
     EString r;
     whitespace();
-    while ( present( "(" ) ) {
+    while ( nextChar() == '(' ) {
+        step();
         r = "";
         uint commentLevel = 1;
         while( commentLevel && !atEnd() ) {
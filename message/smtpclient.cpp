@@ -25,7 +25,8 @@ public:
           owner( 0 ), log( 0 ), sentMail( false ),
           wbt( 0 ), wbs( 0 ),
           enhancedstatuscodes( false ),
-          size( false )
+          size( false ), pipelining( false ), chunking( false ),
+          pipelined( false ), skip( 0 )
     {}
 
     enum State { Invalid,
@@ -48,6 +49,10 @@ public:
 
     bool enhancedstatuscodes;
     bool size;
+    bool pipelining;
+    bool chunking;
+    bool pipelined;
+    uint skip;
     Timer * closeTimer;
     class TimerCloser
         : public EventHandler
@@ -68,6 +73,12 @@ public:
 
     Archiveopteryx uses it to send outgoing messages to a smarthost.
 
+    If the server supports PIPELINING (RFC 2920), SmtpClient sends
+    MAIL FROM, all the RCPT TO commands and DATA/BDAT in one write and
+    then processes the responses in order. If the server supports
+    CHUNKING (RFC 3030), the body is sent with a single BDAT instead
+    of DATA, so it needn't be dot-stuffed and there is one round-trip
+    less.
 */
 
 /*! Constructs an SMTP client which will immediately connect to \a
@@ -183,6 +194,11 @@ void SmtpClient::parse()
             // nonnumeric response
             d->error = "Server sent garbage: " + *s;
         }
+        else if ( (*s)[3] == ' ' && d->skip ) {
+            // a response to a pipelined command which became moot
+            // when an earlier command failed
+            d->skip--;
+        }
         else if ( (*s)[3] == '-' ) {
             if ( d->state == SmtpClientData::Hello ) {
                 recordExtension( *s );
@@ -206,7 +222,7 @@ void SmtpClient::parse()
                 if ( d->state == SmtpClientData::Data ) {
                     log( "Sending body.", Log::Debug );
                     if ( d->dotted.isEmpty() )
-                        d->dotted = dotted( d->dsn->message()->rfc822() );
+                        d->dotted = body();
                     enqueue( d->dotted );
                     d->dotted.truncate();
                     d->wbs = writeBuffer()->size();
@@ -273,12 +289,24 @@ void SmtpClient::sendCommand()
         send.append( ">" );
         if ( d->size ) {
             if ( d->dotted.isEmpty() )
-                d->dotted = dotted( d->dsn->message()->rfc822() );
+                d->dotted = body();
             send.append( " size=" );
             send.append( fn( d->dotted.length() ) );
         }
 
         d->state = SmtpClientData::MailFrom;
+        d->pipelined = d->pipelining;
+        if ( d->pipelined ) {
+            List<Recipient>::Iterator i( d->dsn->recipients() );
+            while ( i ) {
+                if ( i->action() == Recipient::Unknown )
+                    send.append( "\r\nrcpt to:<" +
+                                 i->finalRecipient()->lpdomain() + ">" );
+                ++i;
+            }
+            send.append( "\r\n" );
+            send.append( dataCommand() );
+        }
         break;
 
     case SmtpClientData::MailFrom:
@@ -293,14 +321,22 @@ void SmtpClient::sendCommand()
         while ( d->rcptTo && d->rcptTo->action() != Recipient::Unknown )
             ++d->rcptTo;
         if ( d->rcptTo ) {
-            send = "rcpt to:<" + d->rcptTo->finalRecipient()->lpdomain() + ">";
+            if ( !d->pipelined )
+                send = "rcpt to:<" +
+                       d->rcptTo->finalRecipient()->lpdomain() + ">";
         }
         else {
             if ( !d->accepted.isEmpty() ) {
-                send = "data";
-                d->state = SmtpClientData::Data;
+                if ( !d->pipelined )
+                    send = dataCommand();
+                if ( d->chunking )
+                    d->state = SmtpClientData::Body;
+                else
+                    d->state = SmtpClientData::Data;
             }
             else {
+                if ( d->pipelined )
+                    d->skip++;
                 finish( "4.5.0" );
                 send = "rset";
                 d->state = SmtpClientData::Rset;
@@ -349,13 +385,47 @@ void SmtpClient::sendCommand()
     if ( send.isEmpty() )
         return;
 
-    log( "Sending: " + send, Log::Debug );
+    log( "Sending: " + send.simplified(), Log::Debug );
     enqueue( send + "\r\n" );
-    d->sent = send;
+    if ( d->chunking &&
+         ( send.startsWith( "bdat " ) || send.contains( "\r\nbdat " ) ) ) {
+        enqueue( d->dotted );
+        d->dotted.truncate();
+        d->wbs = writeBuffer()->size();
+        d->wbt = (uint)::time( 0 );
+    }
+    d->sent = send.section( "\r\n", 1 );
     setTimeoutAfter( 300 );
 }
 
 
+/*! Returns the command which starts transmission of the message body,
+    including the body itself if it is sent using BDAT.
+*/
+
+EString SmtpClient::dataCommand()
+{
+    if ( !d->chunking )
+        return "data";
+
+    if ( d->dotted.isEmpty() )
+        d->dotted = body();
+    return "bdat " + fn( d->dotted.length() ) + " last";
+}
+
+
+/*! Returns the message body as it should be transmitted: dot-stuffed
+    for DATA, or just with CRLF line endings for BDAT.
+*/
+
+EString SmtpClient::body() const
+{
+    if ( d->chunking )
+        return d->dsn->message()->rfc822().crlf();
+    return dotted( d->dsn->message()->rfc822() );
+}
+
+
 /*! Returns a dot-escaped version of \a s, with a dot-cr-lf
     appended. This function probably should change lone CR or LF
     characters to CRLF, but it doesn't yet.
@@ -364,29 +434,21 @@ void SmtpClient::sendCommand()
 EString SmtpClient::dotted( const EString & s )
 {
     EString r;
+    r.reserve( s.length() + s.length() / 64 + 5 );
     uint i = 0;
-    uint sol = true;
     while ( i < s.length() ) {
-        if ( s[i] == '\r' ) {
-            sol = true;
-            r.append( "\r\n" );
-            if ( s[i+1] == '\n' )
-                i++;
-        }
-        else if ( s[i] == '\n' ) {
-            sol = true;
-            r.append( "\r\n" );
-        }
-        else {
-            if ( sol && s[i] == '.' )
-                r.append( '.' );
-            r.append( s[i] );
-            sol = false;
-        }
-        i++;
-    }
-    if ( !sol )
+        // i is at the start of a line
+        if ( s[i] == '.' )
+            r.append( '.' );
+        int n = s.findLineBreak( i );
+        if ( n < 0 )
+            n = s.length();
+        r.append( s.data() + i, n - i );
         r.append( "\r\n" );
+        if ( s[n] == '\r' && s[n+1] == '\n' )
+            n++;
+        i = n + 1;
+    }
     r.append( ".\r\n" );
 
     return r;
@@ -508,6 +570,16 @@ void SmtpClient::handleFailure( const EString & line )
             d->rcptTo->setAction( Recipient::Delayed, status );
     }
     else {
+        if ( d->pipelined && d->state == SmtpClientData::MailFrom ) {
+            // the responses to RCPT TO and DATA/BDAT are on their way
+            List<Recipient>::Iterator i( d->dsn->recipients() );
+            while ( i ) {
+                if ( i->action() == Recipient::Unknown )
+                    d->skip++;
+                ++i;
+            }
+            d->skip++;
+        }
         List<Recipient>::Iterator i;
         if ( d->dsn )
             i = d->dsn->recipients();
@@ -574,6 +646,7 @@ void SmtpClient::send( DSN * dsn, EventHandler * user )
 
     d->dsn = dsn;
     d->dotted.truncate();
+    d->accepted.clear();
     d->owner = user;
     d->sentMail = false;
     delete d->closeTimer;
@@ -629,6 +702,12 @@ void SmtpClient::recordExtension( const EString & line )
         d->size = true;
         ::observedSize = l.section( " ", 2 ).number( 0 );
     }
+    else if ( w == "pipelining" ) {
+        d->pipelining = true;
+    }
+    else if ( w == "chunking" ) {
+        d->chunking = true;
+    }
 }
 
 
@@ -43,6 +43,8 @@ private:
     void handleFailure( const EString & );
     void finish( const char * status );
     void recordExtension( const EString & );
+    EString dataCommand();
+    EString body() const;
 
     static EString dotted( const EString & );
 
@@ -20,6 +20,7 @@
 #include "estringlist.h"
 #include "transaction.h"
 #include "configuration.h"
+#include "messagecache.h"
 
 
 class PopData
@@ -29,7 +30,8 @@ public:
     PopData()
         : state( POP::Authorization ), sawUser( false ),
           commands( new List< PopCommand > ), reader( 0 ),
-          reserved( false ), session( 0 ), messages( 0 )
+          reserved( false ), session( 0 ),
+          count( 0 ), uids( 0 ), ids( 0 ), sizes( 0 )
     {}
 
     POP::State state;
@@ -41,7 +43,10 @@ public:
     bool reserved;
     Session * session;
     IntegerSet toBeDeleted;
-    Map<Message> * messages;
+    uint count;
+    uint * uids;
+    uint * ids;
+    uint * sizes;
     EString challenge;
 };
 
@@ -497,15 +502,55 @@ void POP::badUser()
 }
 
 
+/*! Returns the index of \a uid in the message map, or -1 if it isn't
+    there.
+*/
+
+static int indexOf( PopData * d, uint uid )
+{
+    uint b = 0;
+    uint e = d->count;
+    while ( b < e ) {
+        uint m = ( b + e ) / 2;
+        if ( d->uids[m] < uid )
+            b = m + 1;
+        else
+            e = m;
+    }
+    if ( b < d->count && d->uids[b] == uid )
+        return b;
+    return -1;
+}
+
+
 /*! Returns a pointer to the Message object with UID \a uid, or 0 if
-    there isn't any.
+    there isn't any. The Message is created (or found in the
+    MessageCache) on demand, and knows its database ID, but nothing
+    else need have been fetched.
 */
 
 class Message * POP::message( uint uid )
 {
-    if ( !d->messages )
+    int i = indexOf( d, uid );
+    if ( i < 0 || !d->session )
         return 0;
-    return d->messages->find( uid );
+    Message * m = MessageCache::provide( d->session->mailbox(), uid );
+    if ( !m->databaseId() )
+        m->setDatabaseId( d->ids[i] );
+    return m;
+}
+
+
+/*! Returns the RFC 822 size of the message with UID \a uid, or 0 if
+    there is no such message.
+*/
+
+uint POP::messageSize( uint uid )
+{
+    int i = indexOf( d, uid );
+    if ( i < 0 )
+        return 0;
+    return d->sizes[i];
 }
 
 
@@ -515,14 +560,21 @@ void POP::sendChallenge( const EString &s )
 }
 
 
-/*! Records the Message objects needed for this Pop session. Each of
-    the Message objects is presumed to know its database ID, and may
-    know more. \a m is a map from UID to Message objects.
+/*! Records the messages visible in this Pop session: \a count
+    messages, whose UIDs (in ascending order) are in \a uids, their
+    database IDs in \a ids and their RFC 822 sizes in \a sizes.
+
+    The arrays are kept as they are. Message objects are only created
+    by message(), when a command needs one.
 */
 
-void POP::setMessageMap( Map<Message> * m )
+void POP::setMessageMap( uint count, uint * uids, uint * ids,
+                         uint * sizes )
 {
-    d->messages = m;
+    d->count = count;
+    d->uids = uids;
+    d->ids = ids;
+    d->sizes = sizes;
 }
 
 
@@ -5,8 +5,6 @@
 
 #include "saslconnection.h"
 
-#include "map.h"
-
 class User;
 class EString;
 class Session;
@@ -29,6 +27,7 @@ public:
     Session * session() const;
 
     class Message * message( uint );
+    uint messageSize( uint );
 
     void parse();
     void react( Event );
@@ -42,7 +41,7 @@ public:
     void setReader( class PopCommand * );
 
     void markForDeletion( uint );
-    void setMessageMap( Map<Message> * );
+    void setMessageMap( uint, uint *, uint *, uint * );
 
     void badUser();
 
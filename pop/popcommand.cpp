@@ -3,10 +3,10 @@
 #include "popcommand.h"
 
 #include "md5.h"
-#include "map.h"
 #include "utf.h"
 #include "list.h"
 #include "user.h"
+#include "graph.h"
 #include "plain.h"
 #include "query.h"
 #include "buffer.h"
@@ -17,7 +17,6 @@
 #include "mechanism.h"
 #include "estringlist.h"
 #include "permissions.h"
-#include "messagecache.h"
 
 
 class PopCommandData
@@ -28,8 +27,9 @@ public:
         : pop( 0 ), args( 0 ), done( false ),
           m( 0 ), r( 0 ),
           user( 0 ), mailbox( 0 ), permissions( 0 ),
-          session( 0 ), sentFetch( false ), started( false ),
-          message( 0 ), n( 0 ), findIds( 0 ), map( 0 )
+          session( 0 ), started( false ),
+          message( 0 ), n( 0 ), findIds( 0 ),
+          timestamp( GraphableHistogram::timestamp() )
     {}
 
     POP * pop;
@@ -45,13 +45,12 @@ public:
     Permissions * permissions;
     Session * session;
     IntegerSet set;
-    bool sentFetch;
     bool started;
     Message * message;
     int n;
 
     Query * findIds;
-    Map<Message> * map;
+    int64 timestamp;
 
     class PopSession
         : public Session
@@ -95,6 +94,15 @@ PopCommand::PopCommand( POP * pop, Command cmd, EStringList * args )
 
 void PopCommand::finish()
 {
+    static const char * names[] = {
+        "quit", "capa", "noop", "stls", "auth", "user", "pass", "apop",
+        "stat", "list", "retr", "dele", "rset", "top", "uidl",
+        "session"
+    };
+    GraphableHistogram::find( "pop_command_seconds",
+                              "command", names[d->cmd] )
+        ->addSince( d->timestamp );
+
     d->done = true;
     d->pop->runCommands();
 }
@@ -446,100 +454,59 @@ bool PopCommand::session()
     if ( !d->session->initialised() )
         return false;
 
-    if ( !d->map ) {
+    if ( !d->findIds ) {
         d->session->clearUnannounced();
-        IntegerSet s( d->session->messages() );
-        IntegerSet r;
-        d->map = new Map<Message>;
-        while ( !s.isEmpty() ) {
-            uint uid = s.smallest();
-            s.remove( uid );
-            Message * m = MessageCache::provide( d->mailbox, uid );
-            if ( !m->databaseId() )
-                r.add( uid );
-            d->map->insert( uid, m );
-        }
-        if ( !r.isEmpty() ) {
-            d->findIds = new Query( "select message, uid "
-                                    "from mailbox_messages "
-                                    "where mailbox=$1 and uid=any($2)",
-                                    this );
-            d->findIds->bind( 1, d->mailbox->id() );
-            d->findIds->bind( 2, r );
-            d->findIds->execute();
-        }
-    }
-    if ( d->findIds && !d->findIds->done() )
+        d->findIds = new Query( "select mm.uid, mm.message, m.rfc822size "
+                                "from mailbox_messages mm "
+                                "join messages m on (mm.message=m.id) "
+                                "where mm.mailbox=$1 order by mm.uid",
+                                this );
+        d->findIds->bind( 1, d->mailbox->id() );
+        d->findIds->execute();
+    }
+    if ( !d->findIds->done() )
         return false;
-    while ( d->findIds && d->findIds->hasResults() ) {
+
+    // We keep three plain arrays rather than a Message per UID: a
+    // big mailbox is mostly polled by STAT/LIST/UIDL, which need
+    // nothing more.
+    const IntegerSet & s = d->session->messages();
+    uint max = s.count();
+    uint * uids = (uint*)Allocator::alloc( max * sizeof( uint ), 0 );
+    uint * ids = (uint*)Allocator::alloc( max * sizeof( uint ), 0 );
+    uint * sizes = (uint*)Allocator::alloc( max * sizeof( uint ), 0 );
+    uint n = 0;
+    while ( n < max && d->findIds->hasResults() ) {
         Row * r = d->findIds->nextRow();
-        Message * m = d->map->find( r->getInt( "uid" ) );
-        if ( m )
-            m->setDatabaseId( r->getInt( "message" ) );
+        uint uid = r->getInt( "uid" );
+        if ( s.contains( uid ) ) {
+            uids[n] = uid;
+            ids[n] = r->getInt( "message" );
+            sizes[n] = r->getInt( "rfc822size" );
+            n++;
+        }
     }
 
     d->session->clearUnannounced();
-    d->pop->setMessageMap( d->map );
+    d->pop->setMessageMap( n, uids, ids, sizes );
     d->pop->setState( POP::Transaction );
     d->pop->ok( "Done" );
     return true;
 }
 
 
-/*! Handles the guts of the STAT/LIST data acquisition. */
-
-bool PopCommand::fetch822Size()
-{
-    ::List<Message> * l = new ::List<Message>;
-
-    uint n = d->set.count();
-    while ( n >= 1 ) {
-        uint uid = d->set.value( n );
-        Message * m = d->pop->message( uid );
-        if ( m && !m->hasTrivia() )
-            l->prepend( m );
-        n--;
-    }
-
-    if ( l->isEmpty() )
-        return true;
-
-    if ( !d->sentFetch ) {
-        d->sentFetch = true;
-        Fetcher * mtf = new Fetcher( l, this, 0 );
-        mtf->fetch( Fetcher::Trivia );
-        mtf->execute();
-    }
-
-    return false;
-}
-
-
 /*! Handles the STAT command. */
 
 bool PopCommand::stat()
 {
     ::Session * s = d->pop->session();
 
-    if ( !d->started ) {
-        log( "STAT command" );
-        d->started = true;
-        uint n = s->count();
-        while ( n >= 1 ) {
-            d->set.add( s->uid( n ) );
-            n--;
-        }
-    }
-
-    if ( !fetch822Size() )
-        return false;
+    log( "STAT command" );
 
     uint size = 0;
     uint n = s->count();
     while ( n >= 1 ) {
-        Message * m = d->pop->message( s->uid( n ) );
-        if ( m )
-            size += m->rfc822Size();
+        size += d->pop->messageSize( s->uid( n ) );
         n--;
     }
 
@@ -577,16 +544,12 @@ bool PopCommand::list()
         log( "LIST command (" + d->set.set() + ")" );
     }
 
-    if ( !fetch822Size() )
-        return false;
-
     if ( d->args->count() == 1 ) {
         uint uid = d->set.smallest();
-        Message * m = d->pop->message( uid );
+        uint size = d->pop->messageSize( uid );
 
-        if ( m )
-            d->pop->ok( fn( s->msn( uid ) ) + " " +
-                        fn( m->rfc822Size() ) );
+        if ( size )
+            d->pop->ok( fn( s->msn( uid ) ) + " " + fn( size ) );
         else
             d->pop->err( "No such message" );
     }
@@ -596,10 +559,10 @@ bool PopCommand::list()
         d->pop->ok( "Done" );
         while ( i <= d->set.count() ) {
             uint uid = d->set.value( i );
-            Message * m = d->pop->message( uid );
-            if ( m )
+            uint size = d->pop->messageSize( uid );
+            if ( size )
                 d->pop->enqueue( fn( s->msn( uid ) ) + " " +
-                                 fn( m->rfc822Size() ) + "\r\n" );
+                                 fn( size ) + "\r\n" );
             i++;
         }
         d->pop->enqueue( ".\r\n" );
@@ -644,7 +607,7 @@ bool PopCommand::retr( bool lines )
 
         d->started = true;
         Fetcher * f = new Fetcher( d->message, this );
-        if ( !d->message->hasBodies() )
+        if ( !d->message->hasBodies() && !( lines && !d->n ) )
             f->fetch( Fetcher::Body );
         if ( !d->message->hasHeaders() )
             f->fetch( Fetcher::OtherHeader );
@@ -653,15 +616,27 @@ bool PopCommand::retr( bool lines )
         f->execute();
     }
 
-    if ( !( d->message->hasBodies() &&
+    // "TOP n 0" is a common way to look at a message before
+    // downloading it, so we don't fetch the bodies in that case.
+    bool headerOnly = lines && !d->n;
+    if ( !( ( headerOnly || d->message->hasBodies() ) &&
             d->message->hasHeaders() &&
             d->message->hasAddresses() ) )
         return false;
 
+    if ( !headerOnly && !d->message->valid() ) {
+        log( "Cannot send message: " + d->message->error(), Log::Error );
+        d->pop->err( "Could not read message" );
+        return true;
+    }
+
     d->pop->ok( "Done" );
 
     Buffer * b = new Buffer;
-    b->append( d->message->rfc822() );
+    if ( headerOnly )
+        b->append( d->message->header()->asText() + "\r\n" );
+    else
+        b->append( d->message->rfc822() );
 
     int ln = d->n;
     bool header = true;
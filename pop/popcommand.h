@@ -34,7 +34,6 @@ private:
     bool pass();
     bool apop();
     bool session();
-    bool fetch822Size();
     bool stat();
     bool list();
     bool retr( bool );
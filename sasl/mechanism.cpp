@@ -8,10 +8,13 @@
 #include "saslconnection.h"
 #include "estringlist.h"
 #include "ldaprelay.h"
+#include "endpoint.h"
 #include "mailbox.h"
+#include "cache.h"
 #include "scope.h"
 #include "graph.h"
 #include "query.h"
+#include "dict.h"
 #include "user.h"
 #include "utf.h"
 
@@ -23,6 +26,9 @@
 #include "plain.h"
 #include "sasllogin.h"
 
+// time
+#include <time.h>
+
 
 class SaslData
     : public Garbage
@@ -32,7 +38,7 @@ public:
         : state( SaslMechanism::IssuingChallenge ),
           command( 0 ), user( 0 ),
           l( 0 ), type( SaslMechanism::Plain ),
-          connection( 0 ), ldapRelay( 0 )
+          connection( 0 ), ldapRelay( 0 ), refused( false )
     {}
 
     SaslMechanism::State state;
@@ -46,8 +52,113 @@ public:
     SaslMechanism::Type type;
     SaslConnection * connection;
     LdapRelay * ldapRelay;
+    bool refused;
+};
+
+
+class LoginThrottle
+    : public Cache
+{
+public:
+    class Bucket
+        : public Garbage
+    {
+    public:
+        Bucket( uint n, uint now ): units( n * 60 ), at( now ) {}
+        uint units;
+        uint at;
+    };
+
+    LoginThrottle(): Cache( 10 ) {}
+    void clear() { buckets.clear(); }
+
+    Dict<Bucket> buckets;
 };
 
+static LoginThrottle * throttle = 0;
+
+
+/*! Returns the token bucket for \a key, refilled up to the present
+    moment, or a null pointer if there isn't one. If \a create is true,
+    a full bucket is created if necessary.
+
+    Each bucket holds login-failure-limit tokens (in sixtieths, so it
+    can be refilled at that many per minute), and each failed login
+    takes one.
+*/
+
+static LoginThrottle::Bucket * bucket( const EString & key, bool create )
+{
+    uint n = Configuration::scalar( Configuration::LoginFailureLimit );
+    if ( !n || key.isEmpty() )
+        return 0;
+    if ( !::throttle )
+        ::throttle = new LoginThrottle;
+
+    uint now = (uint)time( 0 );
+    LoginThrottle::Bucket * b = ::throttle->buckets.find( key );
+    if ( !b ) {
+        if ( !create )
+            return 0;
+        b = new LoginThrottle::Bucket( n, now );
+        ::throttle->buckets.insert( key, b );
+    }
+    if ( now > b->at ) {
+        if ( now - b->at >= 60 )
+            b->units = n * 60;
+        else
+            b->units += ( now - b->at ) * n;
+        if ( b->units > n * 60 )
+            b->units = n * 60;
+        b->at = now;
+    }
+    return b;
+}
+
+
+/*! Returns the throttling keys for a login attempt as \a login from
+    \a c: one for the client's address (unless it connected via a Unix
+    socket) and one for the login name as used from that address.
+
+    The login name's bucket includes the address so that failures
+    elsewhere can't lock the real user out.
+*/
+
+static EStringList * throttleKeys( SaslConnection * c,
+                                   const UString & login )
+{
+    EStringList * l = new EStringList;
+    EString a;
+    if ( c ) {
+        Endpoint p = c->peer();
+        if ( p.valid() && p.protocol() != Endpoint::Unix ) {
+            a = p.address();
+            l->append( "a " + a );
+        }
+    }
+    if ( !login.isEmpty() )
+        l->append( "l " + a + " " + login.titlecased().utf8() );
+    return l;
+}
+
+
+/*! Takes a token from each of the buckets for a failed login attempt
+    as \a login from \a c.
+*/
+
+static void penalise( SaslConnection * c, const UString & login )
+{
+    EStringList::Iterator k( throttleKeys( c, login ) );
+    while ( k ) {
+        LoginThrottle::Bucket * b = bucket( *k, true );
+        if ( b && b->units >= 60 )
+            b->units -= 60;
+        else if ( b )
+            b->units = 0;
+        ++k;
+    }
+}
+
 
 /*! \class SaslMechanism mechanism.h
     A generic SASL authentication mechanism (RFC 2222)
@@ -184,6 +295,8 @@ void SaslMechanism::setState( State newState )
     case Failed:
         if ( d->connection )
             d->connection->recordAuthenticationFailure();
+        if ( !d->refused )
+            penalise( d->connection, d->login );
         log( "Authentication failed for: " + d->login.utf8().quoted(),
              Log::Debug );
         break;
@@ -279,9 +392,10 @@ void SaslMechanism::readResponse( const EString * r )
     each time a Query notification occurs. It remains in the same
     state until it has enough data to make a decision.
 
-    If the login() name does not exist, this function sets the state to
-    Failed. Otherwise, it calls verify(), which is expected to validate
-    the request and set the state appropriately.
+    If the login() name does not exist, or the attempt is throttled(),
+    this function sets the state to Failed. Otherwise, it calls
+    verify(), which is expected to validate the request and set the
+    state appropriately.
 */
 
 void SaslMechanism::execute()
@@ -299,6 +413,15 @@ void SaslMechanism::execute()
     if ( state() == AwaitingResponse )
         return;
 
+    if ( state() == Authenticating && !d->user && throttled() ) {
+        log( "Too many recent failures; refusing login as " +
+             d->login.utf8().quoted() + " without checking",
+             Log::Debug );
+        d->refused = true;
+        setState( Failed );
+        tick();
+    }
+
     if ( state() == Authenticating ) {
         if ( !d->user  ) {
             d->user = new User;
@@ -413,6 +536,25 @@ void SaslMechanism::verify()
 }
 
 
+/*! Returns true if the client's address, or the login() from that
+    address, has failed to log in more often than login-failure-limit
+    permits, so that this attempt should fail without consulting the
+    database. Attempts refused this way don't count as failures.
+*/
+
+bool SaslMechanism::throttled() const
+{
+    EStringList::Iterator k( throttleKeys( d->connection, d->login ) );
+    while ( k ) {
+        LoginThrottle::Bucket * b = bucket( *k, false );
+        if ( b && b->units < 60 )
+            return true;
+        ++k;
+    }
+    return false;
+}
+
+
 /*! Returns true if this SaslMechanism has reached a final decision
     about the current authentication request.
 */
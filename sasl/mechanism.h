@@ -43,6 +43,7 @@ public:
     virtual void verify();
 
     bool done() const;
+    bool throttled() const;
 
     User * user() const;
     UString login() const;
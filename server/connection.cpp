@@ -9,6 +9,7 @@
 #include "user.h"
 #include "scope.h"
 #include "query.h"
+#include "graph.h"
 #include "buffer.h"
 #include "estring.h"
 #include "endpoint.h"
@@ -512,10 +513,34 @@ Endpoint Connection::peer() const
 }
 
 
-/*! Closes this connection. */
+static GraphableDataSet * compressionRatio = 0;
+
+
+/*! Closes this connection.
+
+    If the connection used compression, this logs how well that
+    worked and adds the ratio and CPU time to the statistics.
+*/
 
 void Connection::close()
 {
+    Buffer * w = d->w;
+    if ( valid() && w && w->compression() == Buffer::Compressing &&
+         w->uncompressedBytes() > 0 ) {
+        uint ratio = (uint)( w->compressedBytes() * 100 /
+                             w->uncompressedBytes() );
+        log( "Compressed " + fn( w->uncompressedBytes() ) +
+             " bytes to " + fn( w->compressedBytes() ) +
+             " (" + fn( ratio ) + "%) using " +
+             fn( ( w->compressionTime() + 500 ) / 1000 ) + "ms CPU",
+             Log::Debug );
+        if ( !compressionRatio )
+            compressionRatio = new GraphableDataSet( "compression-ratio" );
+        compressionRatio->addNumber( ratio );
+        GraphableHistogram::find( "compression_cpu_seconds", "", "" )
+            ->addNumber( (uint)w->compressionTime() );
+    }
+
     if ( valid() && d->fd >= 0 )
         ::close( d->fd );
     setState( Invalid );
@@ -186,6 +186,8 @@ List< Connection > *EventLoop::connections() const
 
 
 static GraphableNumber * sizeinram = 0;
+static GraphableHistogram * iterations = 0;
+static GraphableHistogram * gcPauses = 0;
 
 static const uint gcDelay = 30;
 
@@ -276,10 +278,16 @@ void EventLoop::start()
             FD_ZERO( &w );
         }
         time_t now = time( 0 );
+        int64 started = GraphableHistogram::timestamp();
 
         // Graph our size before processing events
-        if ( !sizeinram )
+        if ( !sizeinram ) {
             sizeinram = new GraphableNumber( "memory-used" );
+            iterations = GraphableHistogram::find( "eventloop_seconds",
+                                                   "", "" );
+            gcPauses = GraphableHistogram::find( "gc_pause_seconds",
+                                                 "", "" );
+        }
         sizeinram->setValue( Allocator::inUse() + Allocator::allocated() );
 
         // Any interesting timers?
@@ -315,6 +323,7 @@ void EventLoop::start()
         // Graph our size after processing all the events too
 
         sizeinram->setValue( Allocator::inUse() + Allocator::allocated() );
+        iterations->addSince( started );
 
         // Collect garbage if someone asks for it, or if we've passed
         // the memory usage goal. This has to be at the end of the
@@ -355,7 +364,9 @@ void EventLoop::start()
                 }
             }
             if ( ::freeMemorySoon ) {
+                int64 freeing = GraphableHistogram::timestamp();
                 Allocator::free();
+                gcPauses->addSince( freeing );
                 gc = time( 0 );
                 ::freeMemorySoon = false;
             }
@@ -4,9 +4,12 @@
 
 #include "allocator.h"
 #include "eventloop.h"
+#include "buffer.h"
+#include "dict.h"
 #include "list.h"
 
 #include <time.h> // time()
+#include <sys/time.h> // gettimeofday, struct timeval
 
 
 static List<GraphableNumber> * numbers = 0;
@@ -263,20 +266,284 @@ void GraphableDataSet::addNumber( uint n )
 }
 
 
+static const uint histogramBuckets = 18;
+static const uint histogramLimits[histogramBuckets-1] = {
+    100, 250, 500,
+    1000, 2500, 5000,
+    10000, 25000, 50000,
+    100000, 250000, 500000,
+    1000000, 2500000, 5000000,
+    10000000, 30000000
+};
+
+
+static List<GraphableHistogram> * histograms = 0;
+static Dict<GraphableHistogram> * histogramIndex = 0;
+
+
+class GraphableHistogramData
+    : public Garbage
+{
+public:
+    GraphableHistogramData(): count( 0 ), sum( 0 ) {
+        uint i = 0;
+        while ( i < histogramBuckets )
+            buckets[i++] = 0;
+        setFirstNonPointer( &count );
+    }
+    EString name;
+    EString label;
+    EString value;
+    // no pointers after this line
+    uint count;
+    int64 sum;
+    uint buckets[::histogramBuckets];
+};
+
+
+/*! \class GraphableHistogram graph.h
+
+    The GraphableHistogram class keeps a latency histogram, e.g. for
+    one IMAP command or one kind of database query.
+
+    Each histogram has a name() and a label, and the histograms can be
+    exported in the Prometheus/OpenMetrics text format by
+    openMetrics(). The bucket limits are fixed, ranging from 100
+    microseconds to 30 seconds in 1-2.5-5 steps, so that histograms
+    for different processes can be added.
+
+    Objects of this class are created by find() and are never
+    deleted. Since each Archiveopteryx process is single-threaded,
+    recording a number is just a few increments.
+*/
+
+
+/*! Constructs a histogram called \a name whose \a label is \a
+    value. Only usable via find().
+*/
+
+GraphableHistogram::GraphableHistogram( const EString & name,
+                                        const EString & label,
+                                        const EString & value )
+    : d( new GraphableHistogramData )
+{
+    d->name = name;
+    d->label = label;
+    d->value = value;
+}
+
+
+/*! Returns a pointer to the histogram called \a name whose \a label
+    is \a value, creating it if necessary. \a label may be empty, in
+    which case \a value is ignored.
+
+    \a name should be a valid Prometheus metric name, without the
+    archiveopteryx_ prefix. \a value is used verbatim, and should not
+    contain quotes, backslashes or newlines.
+*/
+
+GraphableHistogram * GraphableHistogram::find( const EString & name,
+                                               const EString & label,
+                                               const EString & value )
+{
+    if ( !histograms ) {
+        histograms = new List<GraphableHistogram>;
+        Allocator::addEternal( histograms, "histograms for statistics" );
+        histogramIndex = new Dict<GraphableHistogram>;
+        Allocator::addEternal( histogramIndex, "histogram index" );
+    }
+
+    EString k( name );
+    if ( !label.isEmpty() ) {
+        k.append( " " );
+        k.append( value );
+    }
+    GraphableHistogram * h = histogramIndex->find( k );
+    if ( h )
+        return h;
+
+    h = new GraphableHistogram( name, label, value );
+    histogramIndex->insert( k, h );
+
+    // keep each name's histograms together, for openMetrics()
+    List<GraphableHistogram>::Iterator i( histograms );
+    while ( i && i->name() != name )
+        ++i;
+    while ( i && i->name() == name )
+        ++i;
+    histograms->insert( i, h );
+    return h;
+}
+
+
+/*! Records that something took \a microseconds. */
+
+void GraphableHistogram::addNumber( uint microseconds )
+{
+    uint i = 0;
+    while ( i < histogramBuckets - 1 && microseconds > histogramLimits[i] )
+        i++;
+    d->buckets[i]++;
+    d->count++;
+    d->sum += microseconds;
+}
+
+
+/*! Records that something took from \a start, which must have been
+    returned by timestamp(), until now.
+*/
+
+void GraphableHistogram::addSince( int64 start )
+{
+    int64 elapsed = timestamp() - start;
+    if ( elapsed < 0 )
+        elapsed = 0;
+    if ( elapsed > UINT_MAX )
+        elapsed = UINT_MAX;
+    addNumber( (uint)elapsed );
+}
+
+
+/*! Returns the name of this histogram, as given to find(). */
+
+EString GraphableHistogram::name() const
+{
+    return d->name;
+}
+
+
+/*! Returns the number of numbers recorded so far. */
+
+uint GraphableHistogram::count() const
+{
+    return d->count;
+}
+
+
+/*! Returns the current time, in microseconds since the epoch. */
+
+int64 GraphableHistogram::timestamp()
+{
+    struct timeval tv;
+    (void)::gettimeofday( &tv, 0 );
+    return (int64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+/* Returns \a us microseconds formatted as seconds with six decimals. */
+
+static EString seconds( int64 us )
+{
+    EString r;
+    r.appendNumber( us / 1000000 );
+    r.append( "." );
+    EString f( fn( us % 1000000 ) );
+    uint i = f.length();
+    while ( i++ < 6 )
+        r.append( '0' );
+    r.append( f );
+    return r;
+}
+
+
+/* Returns \a n as a Prometheus metric name. */
+
+static EString metricName( const EString & n )
+{
+    EString r( "archiveopteryx_" );
+    uint i = 0;
+    while ( i < n.length() ) {
+        if ( n[i] == '-' )
+            r.append( '_' );
+        else
+            r.append( n[i] );
+        i++;
+    }
+    return r;
+}
+
+
+/*! Returns all GraphableNumber objects (as gauges) and all
+    GraphableHistogram objects in the Prometheus text exposition
+    format, which OpenMetrics scrapers also accept.
+*/
+
+EString GraphableHistogram::openMetrics()
+{
+    EString r;
+
+    List<GraphableNumber>::Iterator n( numbers );
+    while ( n ) {
+        EString m( metricName( n->name() ) );
+        r.append( "# TYPE " + m + " gauge\n" );
+        r.append( m + " " + fn( n->lastValue() ) + "\n" );
+        ++n;
+    }
+
+    EString previous;
+    List<GraphableHistogram>::Iterator h( histograms );
+    while ( h ) {
+        EString m( metricName( h->d->name ) );
+        if ( h->d->name != previous )
+            r.append( "# TYPE " + m + " histogram\n" );
+        previous = h->d->name;
+
+        EString l;
+        if ( !h->d->label.isEmpty() )
+            l = h->d->label + "=\"" + h->d->value + "\",";
+
+        uint c = 0;
+        uint i = 0;
+        while ( i < histogramBuckets ) {
+            c += h->d->buckets[i];
+            r.append( m + "_bucket{" + l + "le=\"" );
+            if ( i < histogramBuckets - 1 )
+                r.append( seconds( histogramLimits[i] ) );
+            else
+                r.append( "+Inf" );
+            r.append( "\"} " + fn( c ) + "\n" );
+            i++;
+        }
+        if ( !l.isEmpty() )
+            l = "{" + l.mid( 0, l.length() - 1 ) + "}";
+        r.append( m + "_sum" + l + " " + seconds( h->d->sum ) + "\n" );
+        r.append( m + "_count" + l + " " + fn( h->d->count ) + "\n" );
+        ++h;
+    }
+
+    return r;
+}
+
+
 /*! \class GraphDumper graph.h
     This Connection subclass is responsible for transferring statistics
     en masse to any client that asks.
+
+    If the client sends an HTTP GET request at once, GraphDumper
+    responds with GraphableHistogram::openMetrics(), so that
+    Prometheus can scrape the statistics port. If the client sends
+    nothing for a second, it gets the history of each GraphableNumber
+    as before, which is what scripts/rrdglue reads.
 */
 
-/*! Dumps a frightful amount of data on the socket \a fd and closes it
-    at once. The EventLoop will flush the data and make this object go
-    away when it can.
+/*! Constructs a GraphDumper for the socket \a fd, which waits briefly
+    to see whether its client speaks HTTP.
 */
 
 GraphDumper::GraphDumper( int fd )
     : Connection( fd, Connection::GraphDumper )
 {
     EventLoop::global()->addConnection( this );
+    setTimeoutAfter( 1 );
+}
+
+
+/*! Dumps a frightful amount of data on the socket. The EventLoop will
+    flush the data and make this object go away when it can.
+*/
+
+void GraphDumper::dumpGraphs()
+{
     List<GraphableNumber>::Iterator i( numbers );
     EString l;
     l.reserve( graphableHistorySize * 20 );
@@ -307,11 +574,49 @@ GraphDumper::GraphDumper( int fd )
         }
         ++i;
     }
-    setTimeoutAfter( 0 );
 }
 
 
-void GraphDumper::react( Event )
+/*! Sends an HTTP response containing the current statistics in the
+    Prometheus text format.
+*/
+
+void GraphDumper::dumpMetrics()
 {
+    EString body( GraphableHistogram::openMetrics() );
+    EString r( "HTTP/1.0 200 OK\r\n"
+               "Content-Type: text/plain; version=0.0.4\r\n"
+               "Connection: close\r\n"
+               "Content-Length: " );
+    r.appendNumber( body.length() );
+    r.append( "\r\n\r\n" );
+    enqueue( r );
+    enqueue( body );
+}
+
+
+void GraphDumper::react( Event e )
+{
+    switch ( e ) {
+    case Read:
+        {
+            EString * l = readBuffer()->removeLine();
+            if ( !l )
+                return;
+            if ( l->startsWith( "GET " ) )
+                dumpMetrics();
+            else
+                dumpGraphs();
+        }
+        break;
+    case Timeout:
+    case Close:
+        dumpGraphs();
+        break;
+    case Connect:
+    case Error:
+    case Shutdown:
+        break;
+    }
     setState( Closing );
 }
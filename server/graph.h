@@ -53,6 +53,28 @@ private:
 };
 
 
+class GraphableHistogram
+    : public Garbage
+{
+public:
+    static GraphableHistogram * find( const EString &,
+                                      const EString &, const EString & );
+
+    void addNumber( uint );
+    void addSince( int64 );
+
+    EString name() const;
+    uint count() const;
+
+    static int64 timestamp();
+    static EString openMetrics();
+
+private:
+    class GraphableHistogramData * d;
+    GraphableHistogram( const EString &, const EString &, const EString & );
+};
+
+
 class GraphDumper
     : public Connection
 {
@@ -60,6 +82,10 @@ public:
     GraphDumper( int );
 
     void react( Event );
+
+private:
+    void dumpGraphs();
+    void dumpMetrics();
 };
 
 
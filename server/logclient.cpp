@@ -20,23 +20,35 @@
 #include <syslog.h>
 
 
-/* This static function returns a nicely-formatted timestamp. */
+/* This static function appends a nicely-formatted timestamp to \a
+   r. Most log lines are sent in bursts, so the date and time are
+   only formatted when the second changes.
+*/
 
-static EString time()
+static void appendTime( EString & r )
 {
+    static time_t second = 0;
+    static char prefix[32];
+
     struct timeval tv;
     struct timezone tz;
     if ( ::gettimeofday( &tv, &tz ) < 0 )
-        return "";
-    struct tm * t = localtime( (const time_t *)&tv.tv_sec );
-
-    // yuck.
-    char result[32];
-    sprintf( result, "%04d-%02d-%02d %02d:%02d:%02d.%03d",
-             t->tm_year + 1900, t->tm_mon+1, t->tm_mday,
-             t->tm_hour, t->tm_min, t->tm_sec,
-             (int)tv.tv_usec/1000 );
-    return result;
+        return;
+    if ( tv.tv_sec != second ) {
+        struct tm * t = localtime( (const time_t *)&tv.tv_sec );
+
+        // yuck.
+        sprintf( prefix, "%04d-%02d-%02d %02d:%02d:%02d.",
+                 t->tm_year + 1900, t->tm_mon+1, t->tm_mday,
+                 t->tm_hour, t->tm_min, t->tm_sec );
+        second = tv.tv_sec;
+    }
+
+    uint ms = (uint)tv.tv_usec / 1000;
+    r.append( prefix );
+    r.append( (char)( '0' + ms / 100 ) );
+    r.append( (char)( '0' + ms / 10 % 10 ) );
+    r.append( (char)( '0' + ms % 10 ) );
 }
 
 
@@ -139,11 +151,11 @@ void LogClient::send( const EString &id, Log::Severity s, const EString & m )
         d->reconnect();
 
     EString t( id );
-    t.reserve( m.length() + 35 );
+    t.reserve( id.length() + m.length() + 50 );
     t.append( " x/" );
     t.append( Log::severity( s ) );
     t.append( " " );
-    t.append( time() );
+    appendTime( t );
     t.append( " " );
     t.append( m.simplified() );
     t.append( "\r\n" );
@@ -99,7 +99,8 @@ public:
           needDateFields( false ),
           needAnnotations( false ),
           needBodyparts( false ),
-          needMessages( false )
+          needMessages( false ),
+          pageSize( 0 ), afterMailbox( 0 ), afterUid( 0 )
     {}
 
     void copy( SelectorData * o ) {
@@ -148,6 +149,10 @@ public:
     bool needAnnotations;
     bool needBodyparts;
     bool needMessages;
+
+    uint pageSize;
+    uint afterMailbox;
+    uint afterUid;
 };
 
 
@@ -529,6 +534,26 @@ void Selector::simplify()
 }
 
 
+/*! Restricts query() to one page of \a size messages: those after
+    \a uid in the mailbox with id \a mailbox, and then those in later
+    mailboxes, in order of mailbox and uid. The \a mailbox is ignored
+    if query() is given a mailbox.
+
+    Each message is returned only once, even if the conditions need
+    joins which would otherwise return it several times. The wanted
+    columns passed to query() must include "mailbox" and "uid", so
+    that the caller can call setPage() again with the last row it
+    received.
+*/
+
+void Selector::setPage( uint size, uint mailbox, uint uid )
+{
+    d->pageSize = size;
+    d->afterMailbox = mailbox;
+    d->afterUid = uid;
+}
+
+
 /*! Returns a query representing this Selector or 0 if anything goes
     wrong, in which case error() contains a description of the problem.
     The Selector is expressed as SQL in the context of the specified
@@ -544,6 +569,9 @@ void Selector::simplify()
     the Query looks at the deleted_messages table instead of the
     mailbox_messages one.
 
+    If setPage() has been used, the query returns only that page, in
+    order of mailbox and uid, regardless of \a order.
+
     The search results will be ordered if \a order is true (this is
     the default). The order is ascending and uses whatever is
     specified in \a wanted of mailbox, thread_root, uid, message and idate.
@@ -577,6 +605,10 @@ Query * Selector::query( User * user, Mailbox * mailbox,
     else
         d->mm = new EString( "mm" );
     EString q = "select ";
+    if ( d->pageSize ) {
+        // the joins some conditions need may return a message twice
+        q.append( "distinct " );
+    }
     if ( wanted ) {
         EStringList::Iterator i( wanted );
         while ( i ) {
@@ -659,29 +691,43 @@ Query * Selector::query( User * user, Mailbox * mailbox,
         // selectors in the tree.
     }
 
-    if ( mboxClause.isEmpty() && w == "true" ) {
+    EString pageClause;
+    if ( d->pageSize ) {
+        // the page starts with an index lookup on the primary key
+        uint uid = placeHolder();
+        d->query->bind( uid, d->afterUid );
+        if ( mboxId ) {
+            pageClause = mm() + ".uid>$" + fn( uid );
+        }
+        else {
+            uint mb = placeHolder();
+            d->query->bind( mb, d->afterMailbox );
+            pageClause = "(" + mm() + ".mailbox," + mm() + ".uid)>"
+                         "($" + fn( mb ) + ",$" + fn( uid ) + ")";
+        }
+    }
+
+    EStringList clauses;
+    if ( !mboxClause.isEmpty() )
+        clauses.append( mboxClause.simplified() );
+    if ( w != "true" )
+        clauses.append( w );
+    if ( !pageClause.isEmpty() )
+        clauses.append( pageClause );
+    if ( clauses.isEmpty() ) {
         // no mailbox, no condition. this will result in a large
         // result set. can it be correct?
     }
-    else if ( mboxClause.isEmpty() ) {
-        // a condition that applies to all mailboxes
-        q.append( " where " );
-        q.append( w );
-    }
-    else if ( w == "true" ) {
-        // a mailbox clause, but no condition
-        q.append( " where " );
-        q.append( mboxClause.simplified() );
-    }
     else {
-        // both.
         q.append( " where " );
-        q.append( mboxClause.simplified() );
-        q.append( " and " );
-        q.append( w );
+        q.append( clauses.join( " and " ) );
     }
 
-    if ( order ) {
+    if ( d->pageSize ) {
+        q.append( " order by " + mm() + ".mailbox, " + mm() + ".uid"
+                  " limit " + fn( d->pageSize ) );
+    }
+    else if ( order ) {
         if ( wanted->contains( "uid" ) && wanted->contains( "mailbox" ) )
             q.append( " order by " + mm() + ".mailbox, " + mm() + ".uid" );
         else if ( wanted->contains( "uid" ) || !wanted )
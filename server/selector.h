@@ -55,6 +55,8 @@ public:
     EString error();
     void setError( const EString & );
 
+    void setPage( uint, uint, uint );
+
     Query * query( class User *, class Mailbox *,
                    class Session *, class EventHandler *,
                    bool = true, class EStringList * = 0, bool = false );
@@ -390,7 +390,7 @@ public:
     SessionInitialiserData()
         : mailbox( 0 ),
           t( 0 ), recent( 0 ), messages( 0 ), expunges( 0 ), nms( 0 ),
-          viewnms( 0 ),
+          viewnms( 0 ), sourcenms( 0 ),
           oldUidnext( 0 ), newUidnext( 0 ),
           state( NoTransaction ),
           changeRecent( false )
@@ -405,6 +405,7 @@ public:
     Query * expunges;
     Query * nms;
     int64 viewnms;
+    int64 sourcenms;
 
     uint oldUidnext;
     uint newUidnext;
@@ -571,13 +572,15 @@ void SessionInitialiser::grabLock()
     if ( d->mailbox->view() )
         d->changeRecent = false;
 
-    log( "Updating " + fn( d->sessions.count() ) + " (of " +
-         fn( d->mailbox->sessions() ? d->mailbox->sessions()->count() : 0 ) +
-         ") session(s) on " +
-         d->mailbox->name().ascii() +
-         " for modseq [" + fn( d->oldModSeq ) + "," +
-         fn( d->newModSeq ) + ">, UID [" + fn( d->oldUidnext ) + "," +
-         fn( d->newUidnext ) + ">" );
+    if ( Log::enabled( Log::Info ) )
+        log( "Updating " + fn( d->sessions.count() ) + " (of " +
+             fn( d->mailbox->sessions()
+                 ? d->mailbox->sessions()->count() : 0 ) +
+             ") session(s) on " +
+             d->mailbox->name().ascii() +
+             " for modseq [" + fn( d->oldModSeq ) + "," +
+             fn( d->newModSeq ) + ">, UID [" + fn( d->oldUidnext ) + "," +
+             fn( d->newUidnext ) + ">" );
 
     if ( !d->t && ( d->changeRecent || d->mailbox->view() ) )
         d->t = new Transaction( this );
@@ -596,7 +599,9 @@ void SessionInitialiser::grabLock()
     if ( !d->mailbox->view() )
         return;
     d->nms = new Query( "select mb.uidnext, mb.nextmodseq, "
-                        " v.nextmodseq as viewnms, v.source "
+                        " v.nextmodseq as viewnms, v.source, "
+                        " (select nextmodseq from mailboxes"
+                        "  where id=v.source) as sourcenms "
                         "from mailboxes mb "
                         "join views v on (v.view=mb.id) "
                         "where mb.id=$1 for update", this );
@@ -677,8 +682,10 @@ void SessionInitialiser::findUidnext()
     if ( !r )
         return;
 
-    if ( d->mailbox->view() )
+    if ( d->mailbox->view() ) {
         d->viewnms = r->getBigint( "viewnms" );
+        d->sourcenms = r->getBigint( "sourcenms" );
+    }
 }
 
 
@@ -687,6 +694,13 @@ void SessionInitialiser::findUidnext()
     view_messages table and the Sessions. Takes care to make the query
     as simple as possible, so it only looks at modseq if necessary.
 
+    views.nextmodseq records how far the view was brought up to date
+    last time. Unless the view's selector depends on the time, only
+    the source messages that were changed or expunged since then can
+    enter or leave the view, so the query looks only at those. The
+    first time, or if the selector is time-sensitive, the query
+    considers all messages.
+
     The generated query is big, complex and invariant. Perhaps we
     should try to make a PreparedStatement. Not sure how. There's
     nowhere natural to put it.
@@ -695,13 +709,11 @@ void SessionInitialiser::findUidnext()
 void SessionInitialiser::findViewChanges()
 {
     Selector * sel = new Selector;
-    sel->add( Selector::fromString( d->mailbox->selector() ) );
+    Selector * view = Selector::fromString( d->mailbox->selector() );
+    sel->add( view );
 
-    // if not dynamic, uidnext changed by >0 and modsec by <= 1,, we
-    // can add UID logic to _both_ the mm and s selects, and it'll do
-    // the right thing.
-
-    if ( d->viewnms )
+    bool incremental = d->viewnms > 1 && !view->timeSensitive();
+    if ( incremental )
         sel->add( new Selector( Selector::Modseq, Selector::Larger,
                                 d->viewnms ) );
     sel->simplify();
@@ -719,19 +731,50 @@ void SessionInitialiser::findViewChanges()
     uint vnms = sel->placeHolder();
     d->messages->bind( vnms, d->viewnms );
 
-    EString s( "select m.id, "
+    EString candidates = "(select id, true as changed from messages)";
+    EString where = "(s.uid is not null and v.uid is null)"
+                    " or (s.uid is null and v.uid is not null)"
+                    " or s.modseq>=$" + fn( vnms );
+    if ( incremental ) {
+        // the candidates are the source messages changed or
+        // expunged since last time, and the view's messages that
+        // some session hasn't seen yet. the latter stay in the view
+        // unless they're among the former.
+        uint src = sel->placeHolder();
+        d->messages->bind( src, d->mailbox->source()->id() );
+        uint ou = sel->placeHolder();
+        d->messages->bind( ou, d->oldUidnext );
+        uint om = sel->placeHolder();
+        d->messages->bind( om, d->oldModSeq );
+        candidates = "(select id, bool_or(changed) as changed from ("
+                     "select message as id, true as changed"
+                     " from mailbox_messages"
+                     " where mailbox=$" + fn( src ) +
+                     " and modseq>=$" + fn( vnms ) +
+                     " union all "
+                     "select message, true from deleted_messages"
+                     " where mailbox=$" + fn( src ) +
+                     " and modseq>=$" + fn( vnms ) +
+                     " union all "
+                     "select message, false from mailbox_messages"
+                     " where mailbox=$" + fn( vid ) +
+                     " and (uid>=$" + fn( ou ) +
+                     " or modseq>=$" + fn( om ) + ")"
+                     ") c group by id)";
+        where = "s.uid is not null or v.uid is not null";
+    }
+
+    EString s( "select m.id, m.changed, "
               "v.uid as vuid, v.modseq as vmodseq, "
               "s.uid as suid, s.modseq as smodseq, "
               "s.seen as sseen, "
               "s.message as smessage "
-              "from messages m "
+              "from " + candidates + " m "
               "left join mailbox_messages v "
               " on (m.id=v.message and v.mailbox=$" + fn( vid ) + ") "
               "left join (" + d->messages->string() + ") s "
               " on m.id=s.message "
-              "where ((s.uid is not null and v.uid is null)"
-              "    or (s.uid is null and v.uid is not null)"
-              "    or s.modseq>=$" + fn( vnms ) + ") "
+              "where (" + where + ") "
               "order by v.uid, s.uid, m.id" );
     d->messages->setString( s );
     submit( d->messages );
@@ -758,8 +801,10 @@ void SessionInitialiser::writeViewChanges()
         if ( !r->isNull( "vuid" ) )
             vuid = r->getInt( "vuid" );
 
+        // a message that's in the view and hasn't changed stays
+        // there; anything else must match the selector.
         bool matched = true;
-        if ( r->isNull( "suid" ) )
+        if ( r->isNull( "suid" ) && ( !vuid || r->getBoolean( "changed" ) ) )
             matched = false;
 
         if ( vuid && !matched ) {
@@ -827,6 +872,14 @@ void SessionInitialiser::writeViewChanges()
             s->expunge( removeInDb );
         }
     }
+
+    if ( d->sourcenms > d->viewnms ) {
+        Query * q = new Query( "update views set nextmodseq=$1 "
+                               "where view=$2", 0 );
+        q->bind( 1, d->sourcenms );
+        q->bind( 2, d->mailbox->id() );
+        submit( q );
+    }
 }
 
 
@@ -1133,6 +1186,7 @@ void SessionPreloader::execute()
                  fn( e.count() ) + " mailboxes empty, " +
                  fn( s.count() ) + " can be preloaded." );
             Transaction * t = new Transaction( this );
+            t->setPriority( Query::Background );
             d->lock
                 = new Query( "select id, uidnext, nextmodseq, first_recent "
                              "from mailboxes where id=any($1) "
@@ -5,9 +5,12 @@
 #include "helperrowcreator.h"
 #include "configuration.h"
 #include "transaction.h"
+#include "dbsignal.h"
 #include "address.h"
 #include "mailbox.h"
+#include "cache.h"
 #include "query.h"
+#include "dict.h"
 
 
 class UserData
@@ -16,7 +19,7 @@ class UserData
 public:
     UserData()
         : id( 0 ), inbox( 0 ), inboxId( 0 ), home( 0 ), address( 0 ), quota( 0 ),
-          q( 0 ), result( 0 ), t( 0 ), user( 0 ),
+          q( 0 ), result( 0 ), t( 0 ), user( 0 ), generation( 0 ),
           state( User::Unverified ),
           mode( LoungingAround )
     {}
@@ -34,6 +37,7 @@ public:
     Query * result;
     Transaction * t;
     EventHandler * user;
+    uint generation;
     EString error;
     User::State state;
 
@@ -47,6 +51,39 @@ public:
 };
 
 
+class UserCache
+    : public Cache
+{
+public:
+    class X: public EventHandler {
+    public:
+        X( UserCache * uc ): me( uc ) {
+            (void)new DatabaseSignal( "users_updated", this );
+        }
+        void execute() {
+            me->clear();
+        }
+        UserCache * me;
+    };
+
+    class Entry
+        : public Garbage
+    {
+    public:
+        Entry( Row * r ): row( r ) {}
+        Row * row;
+    };
+
+    UserCache(): Cache( 10 ), generation( 0 ) { (void)new X( this ); }
+    void clear() { users.clear(); generation++; }
+
+    UDict<Entry> users;
+    uint generation;
+};
+
+static UserCache * cache = 0;
+
+
 /*! \class User user.h
 
     The User class models a single Archiveopteryx user, which may be
@@ -268,6 +305,11 @@ static PreparedStatement * psa;
 
 /*! Starts refreshing this object from the database, and remembers to
     call \a user when the refresh is complete.
+
+    Lookups by login() are cached per process, including those which
+    find no such user, and the cache is cleared whenever the users or
+    aliases tables change. On a cache hit, this object is refreshed at
+    once and \a user is not called.
 */
 
 void User::refresh( EventHandler * user )
@@ -275,6 +317,16 @@ void User::refresh( EventHandler * user )
     if ( d->q )
         return;
     d->user = user;
+    if ( !d->login.isEmpty() ) {
+        if ( !::cache )
+            ::cache = new UserCache;
+        UserCache::Entry * e = ::cache->users.find( d->login.titlecased() );
+        if ( e ) {
+            parse( e->row );
+            return;
+        }
+        d->generation = ::cache->generation;
+    }
     if ( !psl ) {
         psl = new PreparedStatement(
             "select u.id, u.login, u.secret, u.ldapdn, "
@@ -324,8 +376,24 @@ void User::refreshHelper()
     if ( !d->q || !d->q->done() )
         return;
 
-    d->state = Nonexistent;
     Row * r = d->q->nextRow();
+    if ( ::cache && !d->q->failed() && !d->login.isEmpty() &&
+         d->generation == ::cache->generation )
+        ::cache->users.insert( d->login.titlecased(),
+                               new UserCache::Entry( r ) );
+    parse( r );
+    if ( d->user )
+        d->user->execute();
+}
+
+
+/*! Sets this object's data from \a r, a row from refresh()'s query,
+    or to Nonexistent if \a r is null.
+*/
+
+void User::parse( Row * r )
+{
+    d->state = Nonexistent;
     if ( r ) {
         d->id = r->getInt( "id" );
         d->login = r->getUString( "login" );
@@ -355,8 +423,6 @@ void User::refreshHelper()
         d->quota = r->getBigint( "quota" );
         d->state = Refreshed;
     }
-    if ( d->user )
-        d->user->execute();
 }
 
 
@@ -60,6 +60,7 @@ public:
 
 private:
     void refreshHelper();
+    void parse( class Row * );
     void createHelper();
     void csHelper();
 
@@ -453,6 +453,7 @@ bool ManageSieveCommand::putScript()
         d->query->bind( 2, d->name );
         d->query->bind( 3, d->script );
         d->t->enqueue( d->query );
+        d->t->enqueue( new Query( "notify scripts_updated", 0 ) );
 
         d->step = 1;
         d->t->commit();
@@ -2,18 +2,23 @@
 
 #include "sieve.h"
 
+#include "map.h"
 #include "md5.h"
 #include "utf.h"
+#include "dict.h"
 #include "date.h"
 #include "html.h"
 #include "user.h"
+#include "cache.h"
 #include "query.h"
 #include "scope.h"
 #include "address.h"
 #include "mailbox.h"
 #include "message.h"
+#include "dbsignal.h"
 #include "bodypart.h"
 #include "injector.h"
+#include "allocator.h"
 #include "collation.h"
 #include "mimefields.h"
 #include "estringlist.h"
@@ -77,6 +82,8 @@ public:
         EventHandler * handler;
         UStringList flags;
 
+        void use( class SieveAlias *, class ActiveScript *, Log * );
+
         bool evaluate( SieveCommand * );
         enum Result { True, False, Undecidable };
         Result evaluate( SieveTest * );
@@ -127,6 +134,367 @@ SieveData::Recipient * SieveData::recipient( Address * a )
 }
 
 
+class ActiveScript
+    : public Garbage
+{
+public:
+    ActiveScript( Row * );
+
+    uint id;
+    EString source;
+    UString ns;
+    UString login;
+    uint userId;
+};
+
+
+class SieveScriptCache
+    : public Cache
+{
+public:
+    class X: public EventHandler {
+    public:
+        X( SieveScriptCache * ssc ): me( ssc ) {
+            (void)new DatabaseSignal( "scripts_updated", this );
+            (void)new DatabaseSignal( "users_updated", this );
+        }
+        void execute() {
+            me->scripts.clear();
+            me->refresh();
+        }
+        SieveScriptCache * me;
+    };
+
+    class R: public EventHandler {
+    public:
+        R( SieveScriptCache * ssc ): me( ssc ) { setLog( new Log ); }
+        void execute() { me->read(); }
+        SieveScriptCache * me;
+    };
+
+    SieveScriptCache()
+        : Cache( 10 ), current( 0 ), next( 0 ), q( 0 ), again( false ),
+          reader( 0 )
+    {
+        reader = new R( this );
+        (void)new X( this );
+        refresh();
+    }
+    void clear() { scripts.clear(); }
+
+    void refresh();
+    void read();
+    bool usable() const { return current && !q; }
+    ActiveScript * active( uint ) const;
+
+    Map<SieveScript> scripts;
+    Map<ActiveScript> * current;
+    Map<ActiveScript> * next;
+    Query * q;
+    bool again;
+    R * reader;
+};
+
+static SieveScriptCache * scriptCache = 0;
+
+
+/*! Constructs an ActiveScript from the row \a r, which has the
+    columns selected by activeQuery (and by aliasQuery).
+*/
+
+ActiveScript::ActiveScript( Row * r )
+    : id( r->getInt( "scriptid" ) ),
+      source( r->getEString( "script" ).crlf() ),
+      ns( r->getUString( "namespace" ) ),
+      login( r->getUString( "login" ) ),
+      userId( r->getInt( "userid" ) )
+{
+}
+
+
+static const char * activeQuery =
+    "select s.id as scriptid, s.script, "
+    "n.name as namespace, u.id as userid, u.login "
+    "from scripts s "
+    "join users u on (s.owner=u.id) "
+    "left join namespaces n on (u.parentspace=n.id) "
+    "where s.active='t'";
+
+
+/*! Starts reading the active script of each user, or if that's
+    already being done, arranges for it to be done again afterwards.
+    Each script's text is kept once, however many aliases lead to it.
+*/
+
+void SieveScriptCache::refresh()
+{
+    if ( q ) {
+        again = true;
+        return;
+    }
+    again = false;
+    next = new Map<ActiveScript>;
+    q = new Query( EString( activeQuery ), reader );
+    q->setPriority( Query::Background );
+    q->execute();
+}
+
+
+/*! Reads the rows started by refresh(). */
+
+void SieveScriptCache::read()
+{
+    if ( !q )
+        return;
+
+    Row * r;
+    while ( (r = q->nextRow()) != 0 ) {
+        ActiveScript * a = new ActiveScript( r );
+        next->insert( a->userId, a );
+    }
+
+    if ( !q->done() )
+        return;
+
+    if ( !q->failed() )
+        current = next;
+    next = 0;
+    q = 0;
+    if ( again )
+        refresh();
+}
+
+
+/*! Returns the active script of the owner of the mailbox with id \a
+    mailbox, or a null pointer if there is none.
+*/
+
+ActiveScript * SieveScriptCache::active( uint mailbox ) const
+{
+    Mailbox * m = Mailbox::find( mailbox );
+    if ( !m || !m->owner() || !current )
+        return 0;
+    return current->find( m->owner() );
+}
+
+
+/*! Returns a parsed SieveScript for the script with id \a id, whose
+    text is \a source. Parsed scripts are kept in a per-process cache,
+    since the same few scripts are evaluated for very many
+    deliveries, and SieveScript objects are not modified by
+    evaluation. The cache is cleared when ManageSieve changes a
+    script, and each hit is checked against \a source so that a
+    stale entry is never used.
+
+    Parse errors are logged using \a log when the script is parsed.
+*/
+
+static SieveScript * compiledScript( uint id, const EString & source,
+                                     const UString & login, Log * log )
+{
+    if ( !::scriptCache )
+        ::scriptCache = new SieveScriptCache;
+    SieveScript * s = ::scriptCache->scripts.find( id );
+    if ( s && s->source() == source )
+        return s;
+
+    s = new SieveScript;
+    s->parse( source );
+    EString errors = s->parseErrors();
+    if ( !errors.isEmpty() ) {
+        log->log( "Note: Sieve script for " + login.utf8() +
+                  "had parse errors.", Log::Error );
+        EStringList::Iterator i( EStringList::split( '\n', errors ) );
+        while ( i ) {
+            log->log( "Sieve: " + *i, Log::Error );
+            ++i;
+        }
+    }
+    ::scriptCache->scripts.insert( id, s );
+    return s;
+}
+
+
+class SieveAlias
+    : public Garbage
+{
+public:
+    SieveAlias( Row * );
+
+    uint mailbox;
+    UString name;
+    EString localpart;
+    EString domain;
+};
+
+
+/*! Constructs a SieveAlias describing the aliases row \a r, as
+    selected by Sieve::addRecipient() and AliasDirectory.
+*/
+
+SieveAlias::SieveAlias( Row * r )
+    : mailbox( 0 )
+{
+    if ( !r->isNull( "mailbox" ) )
+        mailbox = r->getInt( "mailbox" );
+    name = r->getUString( "name" );
+    localpart = r->getEString( "localpart" );
+    domain = r->getEString( "domain" );
+}
+
+
+/*! Sets up this recipient to be delivered to the mailbox of \a a,
+    using the sieve script \a s if that's not a null pointer. Errors
+    are logged via \a l.
+*/
+
+void SieveData::Recipient::use( SieveAlias * a,
+                                ActiveScript * s, Log * l )
+{
+    if ( a->mailbox )
+        mailbox = Mailbox::find( a->mailbox );
+    if ( !s )
+        return;
+
+    prefix = s->ns + "/" + s->login + "/";
+    user = new User;
+    user->setLogin( s->login );
+    user->setId( s->userId );
+    user->setAddress( new Address( a->name, a->localpart, a->domain ) );
+    script = compiledScript( s->id, s->source, s->login, l );
+    List<SieveCommand>::Iterator c( script->topLevelCommands() );
+    while ( c ) {
+        pending.append( c );
+        ++c;
+    }
+}
+
+
+static const char * aliasQuery =
+    "select al.mailbox, s.id as scriptid, s.script, "
+    "m.owner, n.name as namespace, "
+    "u.id as userid, u.login, "
+    "a.name, a.localpart, a.domain, "
+    "lower(a.localpart) as lp, lower(a.domain) as dom "
+    "from aliases al "
+    "join addresses a on (al.address=a.id) "
+    "join mailboxes m on (al.mailbox=m.id) "
+    "left join scripts s on "
+    " (s.owner=m.owner and s.active='t') "
+    "left join users u on (s.owner=u.id) "
+    "left join namespaces n on (u.parentspace=n.id) "
+    "where m.deleted='f'";
+
+
+static const char * directoryQuery =
+    "select al.mailbox, a.name, a.localpart, a.domain, "
+    "lower(a.localpart) as lp, lower(a.domain) as dom "
+    "from aliases al "
+    "join addresses a on (al.address=a.id) "
+    "join mailboxes m on (al.mailbox=m.id) "
+    "where m.deleted='f'";
+
+
+class AliasDirectory
+    : public EventHandler
+{
+public:
+    class X: public EventHandler {
+    public:
+        X( AliasDirectory * ad ): me( ad ) {
+            (void)new DatabaseSignal( "aliases_updated", this );
+        }
+        void execute() {
+            me->refresh();
+        }
+        AliasDirectory * me;
+    };
+
+    AliasDirectory()
+        : EventHandler(), current( 0 ), next( 0 ), q( 0 ), again( false )
+    {
+        Allocator::addEternal( this, "sieve alias directory" );
+        setLog( new Log );
+        (void)new X( this );
+        refresh();
+    }
+
+    void refresh();
+    void execute();
+    bool usable() const { return current && !q; }
+    SieveAlias * find( const EString &, const EString & ) const;
+
+    Dict<SieveAlias> * current;
+    Dict<SieveAlias> * next;
+    Query * q;
+    bool again;
+};
+
+static AliasDirectory * aliasDirectory = 0;
+
+
+/*! Starts reading all aliases from the database, or if that's already
+    being done, arranges for it to be done again afterwards. The
+    scripts the aliases lead to are kept by SieveScriptCache, so this
+    is needed only when the aliases themselves change.
+*/
+
+void AliasDirectory::refresh()
+{
+    if ( q ) {
+        again = true;
+        return;
+    }
+    again = false;
+    next = new Dict<SieveAlias>;
+    q = new Query( EString( directoryQuery ), this );
+    q->setPriority( Query::Background );
+    q->execute();
+}
+
+
+void AliasDirectory::execute()
+{
+    if ( !q )
+        return;
+
+    Row * r;
+    while ( (r = q->nextRow()) != 0 )
+        next->insert( r->getEString( "lp" ) + "@" + r->getEString( "dom" ),
+                      new SieveAlias( r ) );
+
+    if ( !q->done() )
+        return;
+
+    if ( !q->failed() ) {
+        current = next;
+        log( "Loaded " + fn( current->count() ) + " aliases", Log::Debug );
+    }
+    next = 0;
+    q = 0;
+    if ( again )
+        refresh();
+}
+
+
+/*! Returns the alias for \a localpart@\a domain, which must both be
+    in lower case, or a null pointer if there is no such alias or its
+    mailbox has been deleted since the directory was read.
+*/
+
+SieveAlias * AliasDirectory::find( const EString & localpart,
+                                   const EString & domain ) const
+{
+    SieveAlias * a = current->find( localpart + "@" + domain );
+    if ( !a )
+        return 0;
+    Mailbox * m = Mailbox::find( a->mailbox );
+    if ( !m || m->deleted() )
+        return 0;
+    return a;
+}
+
+
 /*! \class Sieve sieve.h
 
     The Sieve class interprets the Sieve language, which processes
@@ -171,42 +539,11 @@ void Sieve::execute()
                 Row * r = i->sq->nextRow();
                 if ( r || i->sq->done() )
                     i->sq = 0;
-                if ( r ) {
-                    if ( !r->isNull( "mailbox" ) )
-                        i->mailbox = Mailbox::find( r->getInt( "mailbox" ) );
-                    if ( !r->isNull( "script" ) ) {
-                        i->prefix = r->getUString( "namespace" ) + "/" +
-                                    r->getUString( "login" ) + "/";
-                        i->user = new User;
-                        i->user->setLogin( r->getUString( "login" ) );
-                        i->user->setId( r->getInt( "userid" ) );
-                        i->user->setAddress( new Address(
-                                                 r->getUString( "name" ),
-                                                 r->getEString( "localpart" ),
-                                                 r->getEString( "domain" ) ) );
-                        i->script->parse( r->getEString( "script" ).crlf() );
-                        EString errors = i->script->parseErrors();
-                        if ( !errors.isEmpty() ) {
-                            log( "Note: Sieve script for " +
-                                 i->user->login().utf8() +
-                                 "had parse errors.", Log::Error );
-                            EString prefix = "Sieve script for " +
-                                            i->user->login().utf8();
-                            EStringList::Iterator i(
-                                EStringList::split( '\n', errors ) );
-                            while ( i ) {
-                                log( "Sieve: " + *i, Log::Error );
-                                ++i;
-                            }
-                        }
-                        List<SieveCommand>::Iterator
-                            c(i->script->topLevelCommands());
-                        while ( c ) {
-                            i->pending.append( c );
-                            ++c;
-                        }
-                    }
-                }
+                if ( r && r->isNull( "script" ) )
+                    i->use( new SieveAlias( r ), 0, log() );
+                else if ( r )
+                    i->use( new SieveAlias( r ),
+                            new ActiveScript( r ), log() );
             }
             ++i;
         }
@@ -478,18 +815,6 @@ void Sieve::addRecipient( Address * address, EventHandler * user )
 
     r->handler = user;
 
-    r->sq = new Query( "select al.mailbox, s.script, m.owner, "
-                       "n.name as namespace, u.id as userid, u.login, "
-                       "a.name, a.localpart, a.domain "
-                       "from aliases al "
-                       "join addresses a on (al.address=a.id) "
-                       "join mailboxes m on (al.mailbox=m.id) "
-                       "left join scripts s on "
-                       " (s.owner=m.owner and s.active='t') "
-                       "left join users u on (s.owner=u.id) "
-                       "left join namespaces n on (u.parentspace=n.id) "
-                       "where m.deleted='f' and "
-                       "lower(a.localpart)=$1 and lower(a.domain)=$2", this );
     EString localpart( address->localpart() );
     if ( Configuration::toggle( Configuration::UseSubaddressing ) ) {
         EString sep( Configuration::text( Configuration::AddressSeparator ) );
@@ -510,6 +835,25 @@ void Sieve::addRecipient( Address * address, EventHandler * user )
                 localpart = localpart.mid( 0, n );
         }
     }
+
+    // all aliases and active scripts are kept in RAM once they've
+    // been read, so most recipients (and all unknown ones) can be
+    // resolved at once.
+    if ( !::aliasDirectory )
+        ::aliasDirectory = new AliasDirectory;
+    if ( !::scriptCache )
+        ::scriptCache = new SieveScriptCache;
+    if ( ::aliasDirectory->usable() && ::scriptCache->usable() ) {
+        SieveAlias * a = ::aliasDirectory->find( localpart.lower(),
+                                                 address->domain().lower() );
+        if ( a )
+            r->use( a, ::scriptCache->active( a->mailbox ), log() );
+        return;
+    }
+
+    r->sq = new Query( EString( aliasQuery ) +
+                       " and lower(a.localpart)=$1 and lower(a.domain)=$2",
+                       this );
     r->sq->bind( 1, localpart.lower() );
     r->sq->bind( 2, address->domain().lower() );
     r->sq->execute();
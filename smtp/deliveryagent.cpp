@@ -25,13 +25,15 @@ class DeliveryAgentData
 {
 public:
     DeliveryAgentData()
-        : messageId( 0 ), t( 0 ),
+        : messageId( 0 ), delayed( 0 ), owner( 0 ), t( 0 ),
           qm( 0 ), qs( 0 ), qr( 0 ), message( 0 ), expired( false ),
           dsn( 0 ), injector( 0 ), update( 0 ), client( 0 ),
           updatedDelivery( false )
     {}
 
     uint messageId;
+    uint delayed;
+    EventHandler * owner;
     Transaction * t;
     Query * qm;
     Query * qs;
@@ -53,16 +55,18 @@ public:
 */
 
 /*! Creates a new DeliveryAgent object to deliver the message with the
-    given \a id.
+    given \a id. If \a owner is nonzero, it is notified when the
+    DeliveryAgent has finished its work.
 */
 
-DeliveryAgent::DeliveryAgent( uint id )
+DeliveryAgent::DeliveryAgent( uint id, EventHandler * owner )
     : d( new DeliveryAgentData )
 {
     setLog( new Log );
     Scope x( log() );
     log( "Attempting delivery for message " + fn( id ) );
     d->messageId = id;
+    d->owner = owner;
 }
 
 
@@ -85,6 +89,7 @@ void DeliveryAgent::execute()
 
     if ( !d->t ) {
         d->t = new Transaction( this );
+        d->t->setPriority( Query::Background );
         d->qm = new Query(
             "select id, sender, current_timestamp > expires_at as expired "
             "from deliveries where message=$1 for update",
@@ -127,8 +132,12 @@ void DeliveryAgent::execute()
             d->expired = true;
     }
     else if ( !d->qs ) {
+        // if the row exists but we couldn't lock it, we try again
+        // later. if it's gone, there's nothing left to deliver.
+        if ( d->qm->failed() )
+            d->delayed = d->messageId;
         d->t->rollback();
-        d->messageId = 0;
+        finish();
         log( "Could not find/lock deliveries row; aborting" );
         return;
     }
@@ -145,13 +154,31 @@ void DeliveryAgent::execute()
                 d->message->hasBodies() ) )
             return;
 
+        if ( !d->message->valid() ) {
+            // perhaps the blob store is unavailable. try again later.
+            log( "Cannot send message " + fn( d->messageId ) + ": " +
+                 d->message->error(), Log::Error );
+            d->delayed = d->messageId;
+            d->t->rollback();
+            Query * q = new Query( "update deliveries "
+                                   "set next_attempt=current_timestamp+"
+                                   "interval '900 s' where id=$1", 0 );
+            q->bind( 1, d->deliveryId );
+            q->execute();
+            finish();
+            return;
+        }
+
         createDSN();
 
         if ( !d->dsn->deliveriesPending() ) {
-            d->t->rollback();
-            d->messageId = 0;
+            // the spool manager shouldn't look at this row again
             log( "Delivery already completed; will do nothing", Log::Debug );
-            return;
+            Query * q = new Query( "update deliveries set next_attempt=null "
+                                   "where id=$1", this );
+            q->bind( 1, d->deliveryId );
+            d->t->enqueue( q );
+            d->updatedDelivery = true;
         }
     }
 
@@ -181,6 +208,7 @@ void DeliveryAgent::execute()
 
         if ( d->dsn->deliveriesPending() ) {
             // must try again
+            d->delayed = d->messageId;
         }
         else if ( d->dsn->allOk() ) {
             // no need to tell anyone, right?
@@ -211,7 +239,19 @@ void DeliveryAgent::execute()
         SpoolManager::shutdown();
     }
 
+    finish();
+}
+
+
+/*! Records that this DeliveryAgent has nothing more to do, and tells
+    the owner (if any) so.
+*/
+
+void DeliveryAgent::finish()
+{
     d->messageId = 0;
+    if ( d->owner )
+        d->owner->notify();
 }
 
 
@@ -227,6 +267,19 @@ bool DeliveryAgent::working() const
 }
 
 
+/*! Returns the database ID of the message serviced if this
+    DeliveryAgent has finished and some recipients must be tried again
+    later, and 0 otherwise.
+*/
+
+uint DeliveryAgent::delayedMessageId() const
+{
+    if ( d->messageId )
+        return 0;
+    return d->delayed;
+}
+
+
 /*! Begins to fetch a message with the given \a messageId, and returns a
     pointer to the newly-created Message object, which will be filled in
     by the message fetcher.
@@ -401,6 +454,20 @@ void DeliveryAgent::updateDelivery()
             q->execute();
     }
 
+    Query * q;
+    if ( unhandled )
+        q = new Query( "update deliveries "
+                       "set next_attempt=current_timestamp+interval '900 s' "
+                       "where id=$1", this );
+    else
+        q = new Query( "update deliveries set next_attempt=null "
+                       "where id=$1", this );
+    q->bind( 1, d->deliveryId );
+    if ( d->t->state() == Transaction::Executing )
+        d->t->enqueue( q );
+    else
+        q->execute();
+
     if ( d->dsn->allOk() ) {
         if ( handled )
             log( "Delivered message " + fn( d->messageId ) +
@@ -10,6 +10,7 @@
 #include "smtpparser.h"
 #include "estringlist.h"
 #include "eventloop.h"
+#include "graph.h"
 #include "scope.h"
 #include "smtp.h"
 
@@ -20,13 +21,16 @@ class SmtpCommandData
 public:
     SmtpCommandData()
         : responseCode( 200 ), enhancedCode( 0 ),
-          done( false ), smtp( 0 ) {}
+          done( false ), smtp( 0 ),
+          timestamp( GraphableHistogram::timestamp() ) {}
 
     uint responseCode;
     const char * enhancedCode;
     EStringList response;
     bool done;
     SMTP * smtp;
+    EString name;
+    int64 timestamp;
 };
 
 
@@ -56,6 +60,10 @@ SmtpCommand::SmtpCommand( class SMTP * s )
 
 void SmtpCommand::finish()
 {
+    if ( !d->name.isEmpty() )
+        GraphableHistogram::find( "smtp_command_seconds",
+                                  "command", d->name )
+            ->addSince( d->timestamp );
     d->done = true;
     d->smtp->execute();
 }
@@ -216,7 +224,14 @@ SmtpCommand * SmtpCommand::create( SMTP * server, const EString & command )
     else {
         r = new SmtpCommand( server );
         r->respond( 500, "Unknown command (" + c.upper() + ")", "5.5.1" );
+        c.truncate();
     }
+    if ( r->d->done && !c.isEmpty() ) {
+        // finished by the constructor, before it had a name
+        GraphableHistogram::find( "smtp_command_seconds", "command", c )
+            ->addSince( r->d->timestamp );
+    }
+    r->d->name = c;
 
     Scope x( r->log() );
     r->log( "Command: " + command.simplified(), Log::Debug );
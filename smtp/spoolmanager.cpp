@@ -15,6 +15,8 @@
 #include "allocator.h"
 #include "scope.h"
 
+#include <time.h>
+
 
 static SpoolManager * sm;
 static bool shutdown;
@@ -25,21 +27,125 @@ class SpoolManagerData
 {
 public:
     SpoolManagerData()
-        : q( 0 ), t( 0 ), again( false )
+        : q( 0 ), t( 0 ), again( false ), flush( false ),
+          starter( 0 ), rt( 0 ),
+          lastId( 0 ), horizon( 0 ), heap( 0 ), size( 0 ), max( 0 )
     {}
 
     Query * q;
     Timer * t;
     List<DeliveryAgent> agents;
     bool again;
+    bool flush;
+
+    class AgentStarter
+        : public EventHandler
+    {
+    public:
+        AgentStarter(): EventHandler() {}
+        void execute() { if ( ::sm ) ::sm->startAgents(); }
+    };
+
+    EventHandler * starter;
+    Timer * rt;
+
+    uint lastId;
+    uint horizon;
+
+    struct Retry {
+        uint at;
+        uint message;
+    };
+
+    Retry * heap;
+    uint size;
+    uint max;
+    IntegerSet waiting;
+
+    void retry( uint, uint );
+    uint pop();
 };
 
 
+/*! Records that \a message should be retried at time \a at (in
+    seconds since the epoch), unless it's already waiting.
+
+    The waiting messages are kept in a binary min-heap ordered by
+    retry time, so this and pop() are O(log n) however long the queue
+    gets.
+*/
+
+void SpoolManagerData::retry( uint message, uint at )
+{
+    if ( waiting.contains( message ) )
+        return;
+    waiting.add( message );
+
+    if ( size == max ) {
+        max = max ? max * 2 : 256;
+        Retry * n = (Retry*)Allocator::alloc( max * sizeof( Retry ), 0 );
+        uint j = 0;
+        while ( j < size ) {
+            n[j] = heap[j];
+            j++;
+        }
+        heap = n;
+    }
+
+    uint i = size++;
+    while ( i > 0 && heap[(i-1)/2].at > at ) {
+        heap[i] = heap[(i-1)/2];
+        i = (i-1)/2;
+    }
+    heap[i].at = at;
+    heap[i].message = message;
+}
+
+
+/*! Removes the message with the earliest retry time from the heap and
+    returns its ID. The heap must not be empty.
+*/
+
+uint SpoolManagerData::pop()
+{
+    uint message = heap[0].message;
+    waiting.remove( message );
+
+    Retry last = heap[--size];
+    uint i = 0;
+    while ( i * 2 + 1 < size ) {
+        uint c = i * 2 + 1;
+        if ( c + 1 < size && heap[c+1].at < heap[c].at )
+            c++;
+        if ( last.at <= heap[c].at )
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return message;
+}
+
+
 /*! \class SpoolManager spoolmanager.h
 
     This class periodically attempts to deliver mail from the
     deliveries table to a smarthost using DeliveryAgent.
 
+    The deliveries table has an indexed next_attempt column, which
+    says when each message should next be tried. A queue run fetches
+    the rows added since the last run and the rows which become due
+    within the next hour, and adds those which aren't already waiting
+    or being delivered to a heap ordered by retry time. The first run
+    (and the first after a flush) also fetches the overdue rows. Each
+    DeliveryAgent always writes next_attempt when it's done with a
+    message, so later runs need not look at those again.
+
+    Due messages are delivered by at most smarthost-connections
+    DeliveryAgent objects working in parallel. When a delivery attempt
+    fails temporarily, the message goes back onto the heap, 900
+    seconds later, without another queue run.
+
     Each archiveopteryx process has only one instance of this class,
     which is created by SpoolManager::setup().
 */
@@ -48,6 +154,7 @@ SpoolManager::SpoolManager()
     : d( new SpoolManagerData )
 {
     setLog( new Log );
+    d->starter = new SpoolManagerData::AgentStarter;
 
     Query * q = new Query( "update deliveries "
                            "set expires_at=current_timestamp+interval '900 s' "
@@ -58,91 +165,146 @@ SpoolManager::SpoolManager()
                            0 );
     q->bind( 1, Recipient::Unknown );
     q->bind( 2, Recipient::Delayed );
+    q->setPriority( Query::Bulk );
     q->execute();
 }
 
 
 void SpoolManager::execute()
 {
-    // Fetch a list of spooled messages, and the next time we can try
-    // to deliver each of them.
+    // Fetch the deliveries we haven't seen yet and those which become
+    // due within the next hour. The horizon starts at 0, so the first
+    // run also fetches the overdue ones.
 
-    uint delay = UINT_MAX;
+    uint now = (uint)::time( 0 );
 
     if ( !d->q ) {
-        IntegerSet have;
-        List<DeliveryAgent>::Iterator a( d->agents );
-        while ( a ) {
-            if ( a->working() ) {
-                have.add( a->messageId() );
-                delay = 900;
-                ++a;
-            }
-            else {
-                d->agents.take( a );
-            }
-        }
-
         log( "Starting queue run" );
         d->again = false;
         reset();
-        EString s( "select d.message, "
-                   "extract(epoch from"
-                   " min(coalesce(dr.last_attempt+interval '900 s',"
-                   " d.deliver_after,"
-                   " current_timestamp)))::bigint"
-                   "-extract(epoch from current_timestamp)::bigint as delay "
-                   "from deliveries d "
-                   "join delivery_recipients dr on (d.id=dr.delivery) "
-                   "where (dr.action=$1 or dr.action=$2) " );
-        if ( !have.isEmpty() )
-            s.append( "and not d.message=any($3) " );
-        s.append( "group by d.message "
-                  "order by delay" );
-        d->q = new Query( s, this );
-        d->q->bind( 1, Recipient::Unknown );
-        d->q->bind( 2, Recipient::Delayed );
-        if ( !have.isEmpty() )
-            d->q->bind( 3, have );
+        if ( d->flush ) {
+            d->flush = false;
+            d->waiting.clear();
+            d->size = 0;
+            d->lastId = 0;
+            d->horizon = 0;
+        }
+        d->q = new Query( "select id, message, "
+                          "extract(epoch from next_attempt)::bigint as at "
+                          "from deliveries "
+                          "where next_attempt is not null "
+                          "and (id>$1 or"
+                          " (next_attempt>to_timestamp($2) and"
+                          " next_attempt<=to_timestamp($3)))",
+                          this );
+        d->q->bind( 1, d->lastId );
+        d->q->bind( 2, d->horizon );
+        d->q->bind( 3, now + 3600 );
+        d->q->setPriority( Query::Bulk );
         d->q->execute();
     }
 
-    if ( d->q && !d->q->done() )
+    if ( !d->q->done() )
         return;
 
-    // Is there anything we might do?
-
-    if ( d->q && !d->q->rows() ) {
-        // No. Just finish.
-        reset();
-        log( "Ending queue run" );
-        return;
+    if ( d->q->failed() ) {
+        log( "Queue run failed: " + d->q->error(), Log::Error );
     }
+    else if ( d->flush ) {
+        // the next queue run will fetch everything
+    }
+    else {
+        IntegerSet busy;
+        List<DeliveryAgent>::Iterator a( d->agents );
+        while ( a ) {
+            if ( a->messageId() )
+                busy.add( a->messageId() );
+            ++a;
+        }
 
-    // Yes. What?
-
-    if ( d->q ) {
+        uint n = 0;
         while ( d->q->hasResults() ) {
             Row * r = d->q->nextRow();
-            int64 deliverableAt = r->getBigint( "delay" );
-            if ( deliverableAt <= 0 ) {
-                DeliveryAgent * a
-                    = new DeliveryAgent( r->getInt( "message" ) );
-                (void)new Timer( a, d->agents.count() * 5 );
-                d->agents.append( a );
+            uint id = r->getInt( "id" );
+            if ( id > d->lastId )
+                d->lastId = id;
+            uint message = r->getInt( "message" );
+            int64 at = r->getBigint( "at" );
+            if ( !busy.contains( message ) &&
+                 !d->waiting.contains( message ) ) {
+                d->retry( message, at > 0 ? (uint)at : 0 );
+                n++;
             }
-            else if ( delay > deliverableAt )
-                delay = deliverableAt;
-        }
-        if ( delay < UINT_MAX ) {
-            log( "Will process the queue again in " +
-                 fn( delay ) + " seconds" );
-            d->t = new Timer( this, delay );
         }
-        d->q = 0;
+        d->horizon = now + 3600;
+        log( "Queue run found " + fn( n ) + " deliveries; " +
+             fn( d->size ) + " now waiting" );
     }
 
     reset();
+    if ( !d->t ) {
+        // run again well before the horizon is reached
+        d->t = new Timer( this, 3000 );
+    }
+    startAgents();
+}
+
+
+/*! Starts as many DeliveryAgent objects as the smarthost-connections
+    setting allows, taking the messages whose retry time has come from
+    the heap in order. Called whenever a queue run finishes, a
+    DeliveryAgent finishes, or a retry time is reached.
+*/
+
+void SpoolManager::startAgents()
+{
+    if ( ::shutdown )
+        return;
+
+    uint now = (uint)::time( 0 );
+
+    uint busy = 0;
+    List<DeliveryAgent>::Iterator a( d->agents );
+    while ( a ) {
+        if ( a->messageId() ) {
+            ++busy;
+            ++a;
+        }
+        else {
+            if ( a->delayedMessageId() )
+                d->retry( a->delayedMessageId(), now + 900 );
+            d->agents.take( a );
+        }
+    }
+
+    uint max = Configuration::scalar( Configuration::SmartHostConnections );
+    if ( max < 1 )
+        max = 1;
+    while ( busy < max && d->size && d->heap[0].at <= now ) {
+        DeliveryAgent * a = new DeliveryAgent( d->pop(), d->starter );
+        d->agents.append( a );
+        busy++;
+        a->notify();
+    }
+
+    delete d->rt;
+    d->rt = 0;
+    if ( busy < max && d->size ) {
+        uint at = d->heap[0].at;
+        d->rt = new Timer( d->starter, at > now ? at - now : 1 );
+    }
+}
+
+
+/*! Causes the next queue run to forget all waiting deliveries and
+    fetch all of them again. Used by "aox flush queue", which moves
+    next_attempt forward for every spooled message.
+*/
+
+void SpoolManager::reload()
+{
+    d->flush = true;
+    deliverNewMessage();
 }
 
 
@@ -191,6 +353,15 @@ public:
 };
 
 
+class SpoolReloader
+    : public EventHandler
+{
+public:
+    SpoolReloader(): EventHandler() {}
+    void execute() { if ( ::sm ) ::sm->reload(); }
+};
+
+
 /*! Creates a SpoolManager object and a timer to ensure that it's
     started once (after which it will ensure that it wakes up once
     in a while). This function expects to be called from ::main().
@@ -205,6 +376,7 @@ void SpoolManager::setup()
     Allocator::addEternal( ::sm, "spool manager" );
     Database::notifyWhenIdle( sm );
     (void)new DatabaseSignal( "deliveries_updated", new SpoolRunner );
+    (void)new DatabaseSignal( "deliveries_flushed", new SpoolReloader );
 }
 
 
@@ -219,6 +391,10 @@ void SpoolManager::shutdown()
         delete sm->d->t;
         sm->d->t = 0;
     }
+    if ( ::sm && sm->d->rt ) {
+        delete sm->d->rt;
+        sm->d->rt = 0;
+    }
     ::sm = 0;
     ::shutdown = true;
     ::log( "Shutting down outgoing mail due to software problem. "
@@ -18,6 +18,8 @@ public:
     static void shutdown();
 
     void deliverNewMessage();
+    void startAgents();
+    void reload();
 
 private:
     class SpoolManagerData * d;